@@ -0,0 +1,39 @@
+#include "AllocationCounter.h"
+
+static thread_local bool running = false;       // between Start and Stop
+static thread_local bool counting = false;      // running and not paused
+static thread_local size_t allocations = 0;
+
+void AllocationCounter::Start() {
+    allocations = 0;
+    running = true;
+    counting = true;
+}
+
+size_t AllocationCounter::Stop() {
+    running = false;
+    counting = false;
+    return allocations;
+}
+
+void AllocationCounter::Add() {
+    if (counting) {
+        allocations++;
+    }
+}
+
+AllocationCounter::Pause::Pause() : counting(::counting) {
+    ::counting = false;
+}
+
+AllocationCounter::Pause::~Pause() {
+    ::counting = counting;
+}
+
+AllocationCounter::Resume::Resume() : counting(::counting) {
+    ::counting = running;
+}
+
+AllocationCounter::Resume::~Resume() {
+    ::counting = counting;
+}
@@ -0,0 +1,53 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <stddef.h>
+
+// Counts the heap allocations a thread makes while it is running, to check
+// that the steady state of MPC::Solve does not allocate (see mpc_tests).
+//
+// The counting is done by the allocation functions of AllocationHooks.cpp,
+// which only the tests and bench_mpc link; elsewhere, as in the server,
+// the allocator is left alone and Stop returns 0. Solve pauses the count
+// around Ipopt, whose internals allocate on every solve, and MPC_NLP
+// resumes it in each callback Ipopt makes: what is counted is every
+// allocation of a tick except those of Ipopt's own code.
+
+struct AllocationCounter {
+    // Count the allocations of the calling thread
+    static void Start();
+
+    // Allocations of the calling thread since Start
+    static size_t Stop();
+
+    // Called by the allocation functions of AllocationHooks.cpp
+    static void Add();
+
+    // Whether AllocationHooks.cpp replaces malloc, calloc, realloc and the
+    // aligned allocators, so the allocations of Eigen and of the C code of
+    // the solver libraries are seen, and not only operator new. Defined
+    // there.
+    static const bool COMPLETE;
+
+    // Allocations in its scope are not counted. For the internals of the
+    // solver library.
+    class Pause {
+    public:
+        Pause();
+        ~Pause();
+    private:
+        bool counting;
+    };
+
+    // Allocations in its scope are counted again, inside a Pause. For the
+    // callbacks of the solver library, which are ours.
+    class Resume {
+    public:
+        Resume();
+        ~Resume();
+    private:
+        bool counting;
+    };
+};
+
+#endif /* ALLOCATION_COUNTER_H */
@@ -0,0 +1,89 @@
+#include "AllocationCounter.h"
+#include <errno.h>
+#include <new>
+#include <stdlib.h>
+
+// Replaces the allocation functions to count them, see AllocationCounter.h.
+// Linked only into the binaries that count allocations, never the server.
+
+#if defined(__GLIBC__)
+
+const bool AllocationCounter::COMPLETE = true;
+
+// operator new, Eigen and the solver libraries all end up here
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+void* malloc(size_t size) {
+    AllocationCounter::Add();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    AllocationCounter::Add();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    AllocationCounter::Add();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    AllocationCounter::Add();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    AllocationCounter::Add();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    AllocationCounter::Add();
+    void* p = __libc_memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void* valloc(size_t size) {
+    AllocationCounter::Add();
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) {
+    AllocationCounter::Add();
+    return __libc_pvalloc(size);
+}
+}
+
+#else
+
+const bool AllocationCounter::COMPLETE = false;
+
+void* operator new(size_t size) {
+    AllocationCounter::Add();
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+#endif
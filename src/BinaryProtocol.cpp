@@ -0,0 +1,46 @@
+#include "BinaryProtocol.h"
+#include <string.h>
+#include <cmath>
+#include "MPC_Kernel.h"
+
+static_assert(sizeof(TelemetryFrame) == 48 + 16 * MAX_WAYPOINTS, "TelemetryFrame has padding");
+static_assert(sizeof(ActuationFrame) == 32, "ActuationFrame has padding");
+
+// The fields are copied straight from the frame into the telemetry, with
+// memcpy because the frame may be at any alignment.
+
+#define FIELD(field, to) \
+    memcpy(&(to), data + offsetof(TelemetryFrame, field), sizeof(to))
+
+bool ReadTelemetryFrame(const char* data, size_t length, Telemetry& telemetry) {
+    if (length != sizeof(TelemetryFrame)) {
+        return false;
+    }
+    uint32_t magic;
+    uint16_t version;
+    uint16_t n_points;
+    FIELD(magic, magic);
+    FIELD(version, version);
+    FIELD(n_points, n_points);
+    // Too few waypoints to fit the road to
+    if (magic != TELEMETRY_MAGIC || version != PROTOCOL_VERSION || n_points <= KERNEL_ORDER ||
+        n_points > MAX_WAYPOINTS) {
+        return false;
+    }
+    FIELD(sequence, telemetry.sequence);
+    FIELD(x, telemetry.px);
+    FIELD(y, telemetry.py);
+    FIELD(psi, telemetry.psi);
+    FIELD(speed, telemetry.v);
+    telemetry.ptsx.resize(n_points);
+    telemetry.ptsy.resize(n_points);
+    memcpy(telemetry.ptsx.data(), data + offsetof(TelemetryFrame, ptsx), n_points * sizeof(double));
+    memcpy(telemetry.ptsy.data(), data + offsetof(TelemetryFrame, ptsy), n_points * sizeof(double));
+    if (!std::isfinite(telemetry.px) || !std::isfinite(telemetry.py) ||
+        !std::isfinite(telemetry.psi) || !std::isfinite(telemetry.v) ||
+        !telemetry.ptsx.allFinite() || !telemetry.ptsy.allFinite()) {
+        return false;
+    }
+    telemetry.binary = true;
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Telemetry.h"
+
+// Fixed layout frames for clients that speak binary on OpCode::BINARY
+// instead of SocketIO json: a telemetry frame in, an actuation frame back.
+// Fields are little endian and naturally aligned, so the layouts have no
+// padding. Units are those of the json messages.
+
+const uint32_t TELEMETRY_MAGIC = 0x5443504d;   // "MPCT"
+const uint32_t ACTUATION_MAGIC = 0x4143504d;   // "MPCA"
+const uint16_t PROTOCOL_VERSION = 1;
+
+struct TelemetryFrame {
+    uint32_t magic;             // TELEMETRY_MAGIC
+    uint16_t version;           // PROTOCOL_VERSION
+    uint16_t n_points;          // waypoints used, KERNEL_ORDER + 1 to MAX_WAYPOINTS
+    uint32_t sequence;          // echoed by the actuation frame
+    uint32_t reserved;
+    double x;                   // map coordinates
+    double y;
+    double psi;
+    double speed;
+    double ptsx[MAX_WAYPOINTS];
+    double ptsy[MAX_WAYPOINTS];
+};
+
+struct ActuationFrame {
+    enum Flags {
+        FALLBACK = 1            // the previous plan was used, see MPC::fallbacks
+    };
+
+    uint32_t magic;             // ACTUATION_MAGIC
+    uint16_t version;           // PROTOCOL_VERSION
+    uint16_t flags;
+    uint32_t sequence;          // of the telemetry frame
+    uint32_t reserved;
+    double steering_angle;      // in [-1, 1], as in the steer message
+    double throttle;
+};
+
+// Fills `telemetry` from a telemetry frame of `length` bytes at `data`,
+// which need not be aligned. Returns false if it is not one.
+bool ReadTelemetryFrame(const char* data, size_t length, Telemetry& telemetry);
+
+#endif /* BINARY_PROTOCOL_H */
@@ -0,0 +1,146 @@
+#include "Driver.h"
+#include <stdlib.h>
+#include <cassert>
+#include "Eigen-3.3/Eigen/QR"
+#include "Profile.h"
+
+std::tuple<double, double>transformToMap(double x, double y, double x_car, double y_car, double sigma){
+    
+    double newx = x_car + cos(sigma)*x - sin(sigma)*y;
+    double newy = y_car + sin(sigma)*x + cos(sigma)*y;
+    
+    return std::make_tuple(newx, newy);
+}
+
+std::tuple<double, double>transformToCar(double x, double y, double x_car, double y_car, double sigma){
+    
+    double dx = x - x_car;
+    double dy = y - y_car;
+    double carx= cos(sigma)*dx + sin(sigma)*dy;
+    double cary = -sin(sigma)*dx + cos(sigma)*dy;
+    
+    return std::make_tuple(carx, cary);
+}
+
+// Evaluate a polynomial.
+double polyeval(const Eigen::Ref<const Eigen::VectorXd>& coeffs, double x) {
+    double result = 0.0;
+    for (int i = 0; i < coeffs.size(); i++) {
+        result += coeffs[i] * pow(x, i);
+    }
+    return result;
+}
+
+// Fit a polynomial.
+// Adapted from
+// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
+Eigen::VectorXd polyfit(const Eigen::Ref<const Eigen::VectorXd>& xvals,
+                        const Eigen::Ref<const Eigen::VectorXd>& yvals, int order) {
+    assert(xvals.size() == yvals.size());
+    assert(order >= 1 && order <= xvals.size() - 1);
+    Eigen::MatrixXd A(xvals.size(), order + 1);
+    
+    for (int i = 0; i < xvals.size(); i++) {
+        A(i, 0) = 1.0;
+    }
+    
+    for (int j = 0; j < xvals.size(); j++) {
+        for (int i = 0; i < order; i++) {
+            A(j, i + 1) = A(j, i) * xvals(j);
+        }
+    }
+    
+    auto Q = A.householderQr();
+    auto result = Q.solve(yvals);
+    return result;
+}
+
+Options::Options()
+    : backend(Controller::IPOPT), kkt(MPC_RTI::RICCATI), derivatives(Controller::GENERATED),
+      deadline(0.0), decimate(1), warm_start(true) {}
+
+bool Options::Parse(const std::string& arg) {
+    if (arg == "--backend=ipopt") {
+        backend = Controller::IPOPT;
+    } else if (arg == "--backend=rti") {
+        backend = Controller::RTI;
+    } else if (arg == "--backend=compare") {
+        backend = Controller::COMPARE;
+    } else if (arg == "--kkt=riccati") {
+        kkt = MPC_RTI::RICCATI;
+    } else if (arg == "--kkt=condensed") {
+        kkt = MPC_RTI::CONDENSED;
+    } else if (arg == "--derivatives=generated") {
+        derivatives = Controller::GENERATED;
+    } else if (arg == "--derivatives=analytic") {
+        derivatives = Controller::ANALYTIC;
+    } else if (arg == "--derivatives=tape") {
+        derivatives = Controller::TAPE;
+    } else if (arg.compare(0, 11, "--deadline=") == 0) {
+        deadline = atof(arg.c_str() + 11) / 1000.0;
+    } else if (arg.compare(0, 11, "--decimate=") == 0) {
+        decimate = atoi(arg.c_str() + 11);
+    } else if (arg.compare(0, 16, "--linear-solver=") == 0) {
+        linear_solver = arg.substr(16);
+    } else if (arg == "--no-warm-start") {
+        warm_start = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Fit(const Telemetry& telemetry, Road& road, Controller::State& state) {
+    const Waypoints& ptsx = telemetry.ptsx;
+    const Waypoints& ptsy = telemetry.ptsy;
+    double px = telemetry.px;
+    double py = telemetry.py;
+    double psi = telemetry.psi;
+    double v = telemetry.v;
+    
+    // Convert waypoints to car coordinates and build a polynomium for the
+    // track. We do all math in car coordinates
+    
+    Profile::Mark start = Profile::Start();
+    Controller::Coeffs& coeffs = road.coeffs;
+    coeffs = polyfit<Controller::Coeffs::RowsAtCompileTime - 1>(ptsx, ptsy, px, py, psi,
+                                                                 road.last_x);
+    Profile::Since(Profile::POLYFIT, start);
+    
+    // Compoute initial errors. cte is computed as the difference between the track and car position at same x
+    // epsi is the difference in angles
+    
+    double cte = coeffs(0); //  double cte = polyeval(coeffs, px) - py;
+    
+    double epsi =  atan(coeffs(1));
+    
+    // As we have converted to car coordinates, initial x, y and psi are 0.0, no need to compute anything
+
+    state << 0.0, 0.0, 0.0, v, cte, epsi;
+}
+
+Controller::SolveResult Drive(Controller& mpc, const Telemetry& telemetry, Road& road) {
+    Controller::State state;
+    Fit(telemetry, road, state);
+    
+    // Fallbacks are counted by the controller, see MPC::fallbacks
+    return mpc.Solve(state, road.coeffs);
+}
+
+void DummyTelemetry(int k, Telemetry& telemetry) {
+    double curvature = 0.004 * sin(0.3 * k);
+    double offset = sin(0.2 * k);
+    telemetry.ptsx.resize(6);
+    telemetry.ptsy.resize(6);
+    for (int i = 0; i < 6; i++) {
+        double x = -10.0 + 15.0 * i;
+        telemetry.ptsx[i] = x;
+        telemetry.ptsy[i] = offset + curvature * x * x;
+    }
+    telemetry.px = 0.0;
+    telemetry.py = 0.0;
+    telemetry.psi = 0.1 * cos(0.15 * k);
+    telemetry.v = 35.0 + 25.0 * sin(0.05 * k);
+    telemetry.binary = false;
+    telemetry.sequence = k;
+}
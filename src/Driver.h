@@ -0,0 +1,126 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <tuple>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/QR"
+#include "MPC.h"
+#include "Telemetry.h"
+
+// The way from a telemetry message to the actuations, shared by the server
+// and the offline tools: the waypoints are moved to car coordinates, a
+// polynomial is fitted to them and the controller is solved from there.
+
+// For converting back and forth between radians and degrees.
+constexpr double pi() { return M_PI; }
+inline double deg2rad(double x) { return x * pi() / 180; }
+inline double rad2deg(double x) { return x * 180 / pi(); }
+
+/** transform transforms a point in particle coordinates tp one in map coordinates
+ */
+std::tuple<double, double> transformToMap(double x, double y, double x_car, double y_car, double sigma);
+
+std::tuple<double, double> transformToCar(double x, double y, double x_car, double y_car, double sigma);
+
+// Evaluate a polynomial.
+double polyeval(const Eigen::Ref<const Eigen::VectorXd>& coeffs, double x);
+
+// Fit a polynomial.
+Eigen::VectorXd polyfit(const Eigen::Ref<const Eigen::VectorXd>& xvals,
+                        const Eigen::Ref<const Eigen::VectorXd>& yvals, int order);
+
+// Move the waypoints to the coordinates of the car at (px, py) heading psi
+// and fit a polynomial of `Order` to them, in one pass and without
+// allocating: the waypoints are rotated together as a 2xK matrix and the
+// Vandermonde matrix, at most MAX_WAYPOINTS x (Order + 1), is solved with
+// a Householder QR on the stack. Gives what transformToCar and polyfit
+// give, which are kept as the reference. `last_x` is the car x of the
+// last waypoint.
+template <int Order>
+Eigen::Matrix<double, Order + 1, 1> polyfit(const Waypoints& ptsx, const Waypoints& ptsy,
+                                            double px, double py, double psi, double& last_x) {
+    typedef Eigen::Matrix<double, 2, Eigen::Dynamic, 0, 2, MAX_WAYPOINTS> Points;
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Order + 1, 0, MAX_WAYPOINTS, Order + 1> Vandermonde;
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MAX_WAYPOINTS, 1> Column;
+    assert(ptsx.size() == ptsy.size() && ptsx.size() > Order);
+    const int n = ptsx.size();
+
+    // Rotation by -psi of the offsets from the car
+    Eigen::Matrix2d rotation;
+    rotation << cos(psi), sin(psi),
+               -sin(psi), cos(psi);
+    Points offsets(2, n);
+    offsets.row(0) = ptsx.transpose().array() - px;
+    offsets.row(1) = ptsy.transpose().array() - py;
+    Points car(2, n);
+    car.noalias() = rotation * offsets;
+    last_x = car(0, n - 1);
+
+    Vandermonde A(n, Order + 1);
+    A.col(0).setOnes();
+    for (int i = 0; i < Order; i++) {
+        A.col(i + 1) = A.col(i).cwiseProduct(car.row(0).transpose());
+    }
+    Column y = car.row(1).transpose();
+    Eigen::HouseholderQR<Vandermonde> qr(A);
+    return qr.solve(y);
+}
+
+// Horizon of 15 steps and a cubic, with the offsets known at compile time
+typedef MPC<15, 3> Controller;
+
+// Controller settings from the command line
+struct Options {
+    Controller::Backend backend;
+    MPC_RTI::KKT kkt;
+    Controller::Derivatives derivatives;
+    double deadline;
+    int decimate;       // of the visualisation arrays, see SteerWriter
+    std::string linear_solver;  // of Ipopt, its default when empty
+    bool warm_start;    // Ipopt from the shifted previous solution
+
+    Options();
+
+    // Take the option `arg` if it is one of these, see README.md
+    bool Parse(const std::string& arg);
+
+    // Every MPC<N, Order> declares the same enums
+    template <class MPC>
+    void Apply(MPC& mpc) const {
+        mpc.warm_start = warm_start;
+        mpc.backend = typename MPC::Backend(backend);
+        mpc.SetKKT(kkt);
+        mpc.SetDerivatives(typename MPC::Derivatives(derivatives));
+        mpc.deadline = deadline;
+        if (!linear_solver.empty()) {
+            mpc.SetLinearSolver(linear_solver);
+        }
+    }
+};
+
+// The road ahead fitted in car coordinates
+struct Road {
+    Controller::Coeffs coeffs;
+    double last_x;      // of the farthest waypoint
+};
+
+// Fit the road of `telemetry` in car coordinates into `road` and give the
+// state of the car on it
+void Fit(const Telemetry& telemetry, Road& road, Controller::State& state);
+
+// Fit the road of `telemetry` into `road` and solve for it
+Controller::SolveResult Drive(Controller& mpc, const Telemetry& telemetry, Road& road);
+
+// Tick `k` of a made up drive through bends of changing curvature, with
+// the car off the road and off its heading, for the warm-up and the tests
+void DummyTelemetry(int k, Telemetry& telemetry);
+
+// Steering value for the simulator, in [-1, 1]
+inline double SteerValue(const Controller::SolveResult& result) {
+    return -result.steer / deg2rad(25);
+}
+
+#endif /* DRIVER_H */
@@ -0,0 +1,311 @@
+#include "Grisu.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+// A floating point number f * 2^e with a 64 bit significand
+struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t f, int e) : f(f), e(e) {}
+};
+
+struct CachedPower {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+}
+
+static DiyFp Sub(const DiyFp& x, const DiyFp& y) {
+    return DiyFp(x.f - y.f, x.e);
+}
+
+// x * y, the product significand rounded to its upper 64 bits
+static DiyFp Mul(const DiyFp& x, const DiyFp& y) {
+    const uint64_t lo = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & lo;
+    uint64_t c = y.f >> 32, d = y.f & lo;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & lo) + (bc & lo) + (uint64_t(1) << 31);
+    return DiyFp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64);
+}
+
+static DiyFp Normalize(DiyFp x) {
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static DiyFp NormalizeTo(const DiyFp& x, int e) {
+    return DiyFp(x.f << (x.e - e), e);
+}
+
+// 10^k ~ f * 2^e for k = -300, -292, ..., 324, f rounded to nearest
+static const int CACHED_MIN_K = -300;
+static const int CACHED_STEP_K = 8;
+static const CachedPower CACHED_POWERS[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C,  -980, -276},
+    {0xD3515C2831559A83,  -954, -268},
+    {0x9D71AC8FADA6C9B5,  -927, -260},
+    {0xEA9C227723EE8BCB,  -901, -252},
+    {0xAECC49914078536D,  -874, -244},
+    {0x823C12795DB6CE57,  -847, -236},
+    {0xC21094364DFB5637,  -821, -228},
+    {0x9096EA6F3848984F,  -794, -220},
+    {0xD77485CB25823AC7,  -768, -212},
+    {0xA086CFCD97BF97F4,  -741, -204},
+    {0xEF340A98172AACE5,  -715, -196},
+    {0xB23867FB2A35B28E,  -688, -188},
+    {0x84C8D4DFD2C63F3B,  -661, -180},
+    {0xC5DD44271AD3CDBA,  -635, -172},
+    {0x936B9FCEBB25C996,  -608, -164},
+    {0xDBAC6C247D62A584,  -582, -156},
+    {0xA3AB66580D5FDAF6,  -555, -148},
+    {0xF3E2F893DEC3F126,  -529, -140},
+    {0xB5B5ADA8AAFF80B8,  -502, -132},
+    {0x87625F056C7C4A8B,  -475, -124},
+    {0xC9BCFF6034C13053,  -449, -116},
+    {0x964E858C91BA2655,  -422, -108},
+    {0xDFF9772470297EBD,  -396, -100},
+    {0xA6DFBD9FB8E5B88F,  -369,  -92},
+    {0xF8A95FCF88747D94,  -343,  -84},
+    {0xB94470938FA89BCF,  -316,  -76},
+    {0x8A08F0F8BF0F156B,  -289,  -68},
+    {0xCDB02555653131B6,  -263,  -60},
+    {0x993FE2C6D07B7FAC,  -236,  -52},
+    {0xE45C10C42A2B3B06,  -210,  -44},
+    {0xAA242499697392D3,  -183,  -36},
+    {0xFD87B5F28300CA0E,  -157,  -28},
+    {0xBCE5086492111AEB,  -130,  -20},
+    {0x8CBCCC096F5088CC,  -103,  -12},
+    {0xD1B71758E219652C,   -77,   -4},
+    {0x9C40000000000000,   -50,    4},
+    {0xE8D4A51000000000,   -24,   12},
+    {0xAD78EBC5AC620000,     3,   20},
+    {0x813F3978F8940984,    30,   28},
+    {0xC097CE7BC90715B3,    56,   36},
+    {0x8F7E32CE7BEA5C70,    83,   44},
+    {0xD5D238A4ABE98068,   109,   52},
+    {0x9F4F2726179A2245,   136,   60},
+    {0xED63A231D4C4FB27,   162,   68},
+    {0xB0DE65388CC8ADA8,   189,   76},
+    {0x83C7088E1AAB65DB,   216,   84},
+    {0xC45D1DF942711D9A,   242,   92},
+    {0x924D692CA61BE758,   269,  100},
+    {0xDA01EE641A708DEA,   295,  108},
+    {0xA26DA3999AEF774A,   322,  116},
+    {0xF209787BB47D6B85,   348,  124},
+    {0xB454E4A179DD1877,   375,  132},
+    {0x865B86925B9BC5C2,   402,  140},
+    {0xC83553C5C8965D3D,   428,  148},
+    {0x952AB45CFA97A0B3,   455,  156},
+    {0xDE469FBD99A05FE3,   481,  164},
+    {0xA59BC234DB398C25,   508,  172},
+    {0xF6C69A72A3989F5C,   534,  180},
+    {0xB7DCBF5354E9BECE,   561,  188},
+    {0x88FCF317F22241E2,   588,  196},
+    {0xCC20CE9BD35C78A5,   614,  204},
+    {0x98165AF37B2153DF,   641,  212},
+    {0xE2A0B5DC971F303A,   667,  220},
+    {0xA8D9D1535CE3B396,   694,  228},
+    {0xFB9B7CD9A4A7443C,   720,  236},
+    {0xBB764C4CA7A44410,   747,  244},
+    {0x8BAB8EEFB6409C1A,   774,  252},
+    {0xD01FEF10A657842C,   800,  260},
+    {0x9B10A4E5E9913129,   827,  268},
+    {0xE7109BFBA19C0C9D,   853,  276},
+    {0xAC2820D9623BF429,   880,  284},
+    {0x80444B5E7AA7CF85,   907,  292},
+    {0xBF21E44003ACDD2D,   933,  300},
+    {0x8E679C2F5E44FF8F,   960,  308},
+    {0xD433179D9C8CB841,   986,  316},
+    {0x9E19DB92B4E31BA9,  1013,  324},
+};
+
+// The range the exponent of a scaled value is kept in, so its integral part
+// fits 32 bits and the digits of its fraction come out of a 64 bit multiply
+static const int ALPHA = -60;
+static const int GAMMA = -32;
+
+// The cached power c that brings a value with binary exponent e into
+// [ALPHA, GAMMA] when multiplied by it
+static const CachedPower& CachedPowerFor(int e) {
+    // k = ceil((ALPHA - e - 1) * log10(2)), 78913 / 2^18 ~ log10(2)
+    const int f = ALPHA - e - 1;
+    const int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+    const int index = (-CACHED_MIN_K + k + (CACHED_STEP_K - 1)) / CACHED_STEP_K;
+    return CACHED_POWERS[index];
+}
+
+// The number of digits of n, and the power of ten of its first one
+static int Digits(uint32_t n, uint32_t& pow10) {
+    int digits = 1;
+    pow10 = 1;
+    while (n / pow10 >= 10) {
+        pow10 *= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// Move the last digit towards w while it stays inside the boundaries and
+// gets closer: `dist` is the distance from the digits to w, `rest` from
+// the digits to the upper boundary and `delta` between the boundaries, all
+// in units of a last digit `ten`
+static void Round(char* digits, int length, uint64_t dist, uint64_t delta, uint64_t rest,
+                  uint64_t ten) {
+    while (rest < dist && delta - rest >= ten &&
+           (rest + ten < dist || dist - rest > rest + ten - dist)) {
+        digits[length - 1]--;
+        rest += ten;
+    }
+}
+
+// Generate the shortest digits of a number in [low, high] closest to w,
+// all three scaled by the same cached power. The number is the digits
+// times 10^exponent.
+static int Generate(char* digits, int& exponent, const DiyFp& low, const DiyFp& w,
+                    const DiyFp& high) {
+    uint64_t delta = Sub(high, low).f;
+    uint64_t dist = Sub(high, w).f;
+
+    // Split high into its integral and fractional parts
+    const DiyFp one(uint64_t(1) << -high.e, high.e);
+    uint32_t integral = static_cast<uint32_t>(high.f >> -one.e);
+    uint64_t fraction = high.f & (one.f - 1);
+
+    int length = 0;
+    uint32_t pow10;
+    int n = Digits(integral, pow10);
+    while (n > 0) {
+        digits[length++] = static_cast<char>('0' + integral / pow10);
+        integral %= pow10;
+        n--;
+        uint64_t rest = (uint64_t(integral) << -one.e) + fraction;
+        if (rest <= delta) {
+            exponent += n;
+            Round(digits, length, dist, delta, rest, uint64_t(pow10) << -one.e);
+            return length;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for (;;) {
+        fraction *= 10;
+        digits[length++] = static_cast<char>('0' + (fraction >> -one.e));
+        fraction &= one.f - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (fraction <= delta) {
+            break;
+        }
+    }
+    exponent -= m;
+    Round(digits, length, dist, delta, fraction, one.f);
+    return length;
+}
+
+// The digits of a positive finite value, which is the digits times
+// 10^exponent
+static int Grisu2(double value, char* digits, int& exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t F = bits & ((uint64_t(1) << 52) - 1);
+    const int E = static_cast<int>(bits >> 52);
+
+    // value = v.f * 2^v.e, and its boundaries are the halfway points to
+    // its neighbours, closer below at the powers of two
+    const DiyFp v = E == 0 ? DiyFp(F, 1 - 1075) : DiyFp(F + (uint64_t(1) << 52), E - 1075);
+    const DiyFp plus(2 * v.f + 1, v.e - 1);
+    const DiyFp minus = F == 0 && E > 1 ? DiyFp(4 * v.f - 1, v.e - 2) : DiyFp(2 * v.f - 1, v.e - 1);
+    const DiyFp high = Normalize(plus);
+    const DiyFp low = NormalizeTo(minus, high.e);
+
+    const CachedPower& cached = CachedPowerFor(high.e);
+    const DiyFp c(cached.f, cached.e);
+    const DiyFp w = Mul(Normalize(v), c);
+    DiyFp w_low = Mul(low, c);
+    DiyFp w_high = Mul(high, c);
+
+    // The products are off by up to one unit, so keep inside them
+    w_low.f++;
+    w_high.f--;
+    exponent = -cached.k;
+    return Generate(digits, exponent, w_low, w, w_high);
+}
+
+int WriteDouble(double value, char* buffer) {
+    if (!isfinite(value)) {
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    char* out = buffer;
+    if (signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *out++ = '0';
+        return static_cast<int>(out - buffer);
+    }
+
+    char digits[18];
+    int exponent;
+    int length = Grisu2(value, digits, exponent);
+
+    // The decimal point goes after the first `point` digits
+    int point = length + exponent;
+    if (length <= point && point <= 17) {
+        // 1234000
+        memcpy(out, digits, length);
+        out += length;
+        memset(out, '0', point - length);
+        out += point - length;
+    } else if (0 < point && point <= 17) {
+        // 12.34
+        memcpy(out, digits, point);
+        out += point;
+        *out++ = '.';
+        memcpy(out, digits + point, length - point);
+        out += length - point;
+    } else if (-4 < point && point <= 0) {
+        // 0.001234
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -point);
+        out += -point;
+        memcpy(out, digits, length);
+        out += length;
+    } else {
+        // 1.234e-05
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, length - 1);
+            out += length - 1;
+        }
+        int e = point - 1;
+        *out++ = 'e';
+        *out++ = e < 0 ? '-' : '+';
+        e = e < 0 ? -e : e;
+        if (e >= 100) {
+            *out++ = static_cast<char>('0' + e / 100);
+            e %= 100;
+        }
+        *out++ = static_cast<char>('0' + e / 10);
+        *out++ = static_cast<char>('0' + e % 10);
+    }
+    return static_cast<int>(out - buffer);
+}
@@ -0,0 +1,20 @@
+#ifndef GRISU_H
+#define GRISU_H
+
+// Shortest round trip formatting of doubles with Grisu2 (Florian Loitsch,
+// "Printing floating-point numbers quickly and accurately with integers",
+// PLDI 2010).
+//
+// The digits always read back as the same double, and they are the fewest
+// that do for all but a few values in a thousand, which get one more. It
+// works on 64 bit integers and a table of powers of ten: no snprintf, no
+// strtod, no allocation.
+
+// Longest text WriteDouble writes, without a terminating null
+static const int DOUBLE_CHARS = 25;
+
+// Write `value` into `buffer` as a JSON number, like %g but with the digits
+// above, or null if it is not finite. Returns the number of chars written.
+int WriteDouble(double value, char* buffer);
+
+#endif /* GRISU_H */
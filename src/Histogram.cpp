@@ -0,0 +1,72 @@
+#include "Histogram.h"
+
+static const uint64_t SUB = uint64_t(1) << Histogram::SUB_BITS;
+
+Histogram::Histogram() : count(0), sum(0), max(0) {
+    Clear();
+}
+
+void Histogram::Clear() {
+    for (size_t i = 0; i < BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+size_t Histogram::Index(uint64_t value) {
+    if (value < SUB) {
+        return value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - SUB_BITS;
+    return (size_t(shift + 1) << SUB_BITS) + ((value >> shift) & (SUB - 1));
+}
+
+uint64_t Histogram::Lower(size_t bucket) {
+    if (bucket < SUB) {
+        return bucket;
+    }
+    int shift = int(bucket >> SUB_BITS) - 1;
+    return (SUB + (bucket & (SUB - 1))) << shift;
+}
+
+uint64_t Histogram::Upper(size_t bucket) {
+    if (bucket < SUB) {
+        return bucket;
+    }
+    int shift = int(bucket >> SUB_BITS) - 1;
+    return Lower(bucket) + ((uint64_t(1) << shift) - 1);
+}
+
+void Histogram::Add(uint64_t value) {
+    buckets[Index(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t old = max.load(std::memory_order_relaxed);
+    while (value > old && !max.compare_exchange_weak(old, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::Percentile(double p) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        total += Bucket(i);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the value, from 1
+    uint64_t rank = uint64_t(p * total + 0.5);
+    rank = rank < 1 ? 1 : rank > total ? total : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += Bucket(i);
+        if (seen >= rank) {
+            uint64_t upper = Upper(i);
+            return upper < Max() ? upper : Max();
+        }
+    }
+    return Max();
+}
@@ -0,0 +1,61 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Log-linear histogram of durations in nanoseconds that any thread may add
+// to without locking.
+//
+// Values below 16 have a bucket each; above, every power of two is split
+// into 16 buckets of equal width, so a bucket is within 1/16 of the values
+// it holds. 976 buckets cover the whole uint64_t range. Add is a few
+// relaxed atomic increments; the readers see each counter on its own, so a
+// reading taken while threads add may be off by the values in flight.
+
+class Histogram {
+public:
+    static const int SUB_BITS = 4;
+    static const size_t BUCKETS = ((64 - SUB_BITS + 1) << SUB_BITS);
+
+    Histogram();
+
+    void Add(uint64_t value);
+
+    // Empty it. Not atomic with respect to Add.
+    void Clear();
+
+    uint64_t Count() const {
+        return count.load(std::memory_order_relaxed);
+    }
+    uint64_t Sum() const {
+        return sum.load(std::memory_order_relaxed);
+    }
+    uint64_t Max() const {
+        return max.load(std::memory_order_relaxed);
+    }
+    uint64_t Bucket(size_t i) const {
+        return buckets[i].load(std::memory_order_relaxed);
+    }
+
+    // The value under which a fraction `p` of the values fall, to the
+    // width of its bucket. 0 when empty.
+    uint64_t Percentile(double p) const;
+
+    // Bucket of `value` and the smallest and largest values of a bucket
+    static size_t Index(uint64_t value);
+    static uint64_t Lower(size_t bucket);
+    static uint64_t Upper(size_t bucket);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    Histogram(const Histogram&);
+    Histogram& operator=(const Histogram&);
+};
+
+#endif /* HISTOGRAM_H */
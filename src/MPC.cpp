@@ -1,163 +1,104 @@
 #include "MPC.h"
+#include "MPC_Model.h"
+#include "MPC_Kernel.h"
+#include "AllocationCounter.h"
+#include "Profile.h"
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
 #include "Eigen-3.3/Eigen/Core"
 #include <math.h>
+#include <stdlib.h>
 
 using CppAD::AD;
 
-size_t N = 15;
-double dt = 0.05;
-
-// This value assumes the model presented in the classroom is used.
-//
-// It was obtained by measuring the radius formed by running the vehicle in the
-// simulator around in a circle with a constant steering angle and velocity on a
-// flat terrain.
-//
-// Lf was tuned until the the radius formed by the simulating the model
-// presented in the classroom matched the previous radius.
-//
-
-// Some values : N 25, dt 0.05 // Coefs 50/150, till 0, 2500
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
-double ref_v = 60;
-
-// Parameters for speed regulator.
-//  When te road is straight we try to get maximum speed
-//  When it mades turns we reduce speed according the factor.
-//  A factor of 2 means reduce to halve speed when road turns 45º
-// Minimum speed is the minimum speed to drive
-double max_v = 100.0;   // target màximum value
-double min_v = 45.0;   // target màximum value
-double dec_factor = 2.0; // Factor to deccelerate when bendy
-
-// The solver takes all the state variables and actuator
-// variables in a singular vector. Thus, we should to establish
-// when one variable starts and another ends to make our lifes easier.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
-
-
+template <class Layout>
 class FG_eval {
 public:
-    Eigen::VectorXd coeffs;
-    // Coefficients of the fitted polynomial.
-    FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
-    
     typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
-    // `fg` is a vector containing the cost and constraints.
-    // `vars` is a vector containing the variable values (state & actuators).
     
+    const MPCConfig& config;
+    Layout layout;
     
-    
-    // Evaluate a polynomial.
-    double polyeval1(Eigen::VectorXd coeffs,  double x) {
-        double result = 0.0;
-        for (int i = 0; i < coeffs.size(); i++) {
-            result += coeffs[i] * pow(x, i);
-        }
-        return result;
+    // Coefficients of the fitted polynomial and reference speed.
+    // They are CppAD dynamic parameters so the tape is recorded only once.
+    ADvector coeffs;
+    AD<double> ref_v;
+    FG_eval(const MPCConfig& config, const ADvector& params) : config(config), layout(config) {
+        coeffs = params;
+        ref_v = params[layout.ref_v_param()];
     }
     
+    // `fg` is a vector containing the cost and constraints.
+    // `vars` is a vector containing the variable values (state & actuators).
     void operator()(ADvector& fg, const ADvector& vars) {
         
+        // The model of each step is in MPC_Model.h
+        const size_t N = layout.size();
+        const size_t delta_start = layout.delta_start();
+        const size_t a_start = layout.a_start();
+        size_t starts[] = {layout.x_start(), layout.y_start(), layout.psi_start(),
+            layout.v_start(), layout.cte_start(), layout.epsi_start()};
+        AD<double> s0[Model::N_STATE];
+        AD<double> s1[Model::N_STATE];
+        AD<double> u0[Model::N_ACTUATION];
+        AD<double> u1[Model::N_ACTUATION];
+        AD<double> g[Model::N_STATE];
+        
         // The cost is stored is the first element of `fg`.
         // Any additions to the cost should be added to `fg[0]`.
         fg[0] = 0;
         
         // The part of the cost based on the reference state.
         for (int t = 0; t < N; t++) {
-            fg[0] += CppAD::pow(vars[cte_start + t], 2);
-            fg[0] += CppAD::pow(vars[epsi_start + t], 2);
-            fg[0] += CppAD::pow(vars[v_start + t] - ref_v, 2);
+            for (int i = 0; i < Model::N_STATE; i++) {
+                s0[i] = vars[starts[i] + t];
+            }
+            fg[0] += Model::StateCost(s0, ref_v);
         }
         
         // Minimize the use of actuators.
-        
         for (int t = 0; t < N - 1; t++) {
-            fg[0] += 150*CppAD::pow(vars[delta_start + t], 2);
-            fg[0] += CppAD::pow(vars[a_start + t], 2);
+            u0[Model::DELTA] = vars[delta_start + t];
+            u0[Model::A] = vars[a_start + t];
+            fg[0] += Model::ActuationCost(u0, config.w_delta);
         }
         
         // Minimize the value gap between sequential actuations.
         for (int t = 0; t < N - 2; t++) {
-            fg[0] += 2000.0*CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);
-            fg[0] += CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);
+            u0[Model::DELTA] = vars[delta_start + t];
+            u0[Model::A] = vars[a_start + t];
+            u1[Model::DELTA] = vars[delta_start + t + 1];
+            u1[Model::A] = vars[a_start + t + 1];
+            fg[0] += Model::ActuationChangeCost(u0, u1, config.w_ddelta);
         }
         
-        
         //
         // Setup Constraints
         //
-        // NOTE: In this section you'll setup the model constraints.
-        
         // Initial constraints
         //
         // We add 1 to each of the starting indices due to cost being located at
         // index 0 of `fg`.
         // This bumps up the position of all the other values.
-        fg[1 + x_start] = vars[x_start];
-        fg[1 + y_start] = vars[y_start];
-        fg[1 + psi_start] = vars[psi_start];
-        fg[1 + v_start] = vars[v_start];
-        fg[1 + cte_start] = vars[cte_start];
-        fg[1 + epsi_start] = vars[epsi_start];
+        for (int i = 0; i < Model::N_STATE; i++) {
+            fg[1 + starts[i]] = vars[starts[i]];
+        }
         
         // The rest of the constraints
         for (int t = 1; t < N; t++) {
-            // The state at time t+1 .
-            AD<double> x1 = vars[x_start + t];
-            AD<double> y1 = vars[y_start + t];
-            AD<double> psi1 = vars[psi_start + t];
-            AD<double> v1 = vars[v_start + t];
-            AD<double> cte1 = vars[cte_start + t];
-            AD<double> epsi1 = vars[epsi_start + t];
-            
-            // The state at time t.
-            AD<double> x0 = vars[x_start + t - 1];
-            AD<double> y0 = vars[y_start + t - 1];
-            AD<double> psi0 = vars[psi_start + t - 1];
-            AD<double> v0 = vars[v_start + t - 1];
-            AD<double> cte0 = vars[cte_start + t - 1];
-            AD<double> epsi0 = vars[epsi_start + t - 1];
+            for (int i = 0; i < Model::N_STATE; i++) {
+                s0[i] = vars[starts[i] + t - 1];
+                s1[i] = vars[starts[i] + t];
+            }
             
             // Only consider the actuation at time t.
-            AD<double> delta0 = vars[delta_start + t - 1];
-            AD<double> a0 = vars[a_start + t - 1];
-            
-            AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0*x0 + coeffs[3]*x0*x0*x0;
-            AD<double> x01 = x0 + v0 * CppAD::cos(psi0) * dt;
-            AD<double> f1 = coeffs[0] + coeffs[1] * x01 + coeffs[2] * x01*x01 + coeffs[3] * x01*x01*x01 ;
+            u0[Model::DELTA] = vars[delta_start + t - 1];
+            u0[Model::A] = vars[a_start + t - 1];
             
-            //AD<double> psides0 = CppAD::atan(coeffs[1]);
-            AD<double> psides0 = CppAD::atan(coeffs[1] + coeffs[2]*x0 + coeffs[3]*x0*x0);
-            
-            // Here's `x` to get you started.
-            // The idea here is to constraint this value to be 0.
-            //
-            // Recall the equations for the model:
-            // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
-            // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
-            // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
-            // v_[t+1] = v[t] + a[t] * dt
-            // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt -
-            // epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
-            
-            fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-            fg[1 + y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-            fg[1 + psi_start + t] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
-            fg[1 + v_start + t] = v1 - (v0 + a0 * dt);
-            fg[1 + cte_start + t] = cte1 - (f1-(y0 + v0 * CppAD::sin(psi0) * dt));
-            //fg[1 + cte_start + t] = cte1 - ((f0 - y0) + ((v0 * CppAD::sin(epsi0) * dt) ));
-            fg[1 + epsi_start + t] = epsi1 - ((psi0 - psides0) + v0 * delta0 / Lf * dt);
+            Model::Step(s0, u0, s1, coeffs, layout.order(), config.dt, config.Lf, g);
+            for (int i = 0; i < Model::N_STATE; i++) {
+                fg[1 + starts[i] + t] = g[i];
+            }
         }
     }
 };
@@ -165,64 +106,105 @@ public:
 //
 // MPC class definition implementation.
 //
-MPC::MPC() {}
-MPC::~MPC() {}
 
+// The config with the fixed N and Order of the template
+template <int N, int Order>
+static MPCConfig Specialize(MPCConfig config) {
+    MPCLayout<N, Order> layout(config);
+    config.N = layout.size();
+    config.order = layout.order();
+    return config;
+}
 
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
-    //size_t i;
-    //typedef CPPAD_TESTVECTOR(double) Dvector;
-    
-    
-    
-    double x = state[0];
-    double y = state[1];
-    double psi = state[2];
-    double v = state[3];
-    double cte = state[4];
-    double epsi = state[5];
-    
-    // Supose we are at x = 0 because that is our frame of reference
-    // We compute the direction of the pol. at x = v * dt* N
-    
-    double lx = v * dt * N ;
-    double deriv = 3 * coeffs[3] * lx*lx + 2 * coeffs[2]*lx + coeffs[1];
-    double psil = atan(deriv);
-    
-    // We use a simple algoritm to set speed. That way in straight roads
-    // we go fast and in bends we slow.
-    
-    ref_v = (max_v-min_v) * (1 - fabs(psil)*dec_factor/M_PI) + min_v;
-    
-    
-    
-    
+static MPC_RTI::Options RTIOptions() {
+    MPC_RTI::Options options;
+    options.max_qp_iter = 20;
+    options.kkt = MPC_RTI::RICCATI;
+    return options;
+}
+
+template <int N, int Order>
+MPC<N, Order>::MPC(const MPCConfig& config) : config(Specialize<N, Order>(config)),
+    layout(this->config), ref_v(60), warm_start(false), backend(IPOPT), deadline(0),
+    deadline_misses(0), fallbacks(0), rti_steer_diff(0), rti_throttle_diff(0),
+    rti_max_steer_diff(0), rti_max_throttle_diff(0),
+    rti(this->config, RTIOptions()), analytic(this->config),
+    generated(this->config), rti_valid(false), ipopt_warm_start(false), plan_valid(false),
+    serial(true) {
     
     // number of independent variables
     // N timesteps == N - 1 actuations
-    size_t n_vars = N * 6 + (N - 1) * 2;  // 2 son els actuators
+    size_t n_vars = layout.n_vars();  // 2 son els actuators
     
     // Number of constraints
-    size_t n_constraints = N * 6; // 6 son les variables
-    
+    size_t n_constraints = layout.n_constraints(); // 6 son les variables
+    
+    // Record the tape once. Each call to Solve only updates the
+    // coefficients and reference speed.
+    nlp = new MPC_NLP(solution);
+    nlp->Record<FG_eval<Layout> >(this->config, n_vars, n_constraints, layout.n_params());
+    SetDerivatives(GENERATED);
+    params.resize(layout.n_params());
+    shifted.resize(n_vars);
+    plan.resize(n_vars);
+    SetBounds();
     
-    // Initial value of the independent variables.
-    // Should be 0 except for the initial values.
-    Dvector vars(n_vars);
-    for (int i = 0; i < n_vars; i++) {
-        vars[i] = 0.0;
+    // options
+    app = Ipopt::IpoptApplicationFactory();
+    app->Options()->SetIntegerValue("print_level", 0);
+    app->Options()->SetStringValue("sb", "yes");
+    
+    // Used only when warm_start_init_point is on. The shifted solution is
+    // close to the optimum so we do not push it away from the bounds.
+    app->Options()->SetNumericValue("warm_start_bound_push", 1e-6);
+    app->Options()->SetNumericValue("warm_start_mult_bound_push", 1e-6);
+    app->Options()->SetStringValue("warm_start_init_point", "no");
+    app->Initialize();
+}
+
+template <int N, int Order>
+MPC<N, Order>::~MPC() {
+    // MUMPS frees its global state with the solver
+    std::unique_lock<std::mutex> lock(MPC_NLP::mutex, std::defer_lock);
+    if (serial) {
+        lock.lock();
     }
-    // Set the initial variable values
-    vars[x_start] = x;
-    vars[y_start] = y;
-    vars[psi_start] = psi;
-    vars[v_start] = v;
-    vars[cte_start] = cte;
-    vars[epsi_start] = epsi;
+    app = NULL;
+}
+
+template <int N, int Order>
+void MPC<N, Order>::SetLinearSolver(const std::string& linear_solver) {
+    app->Options()->SetStringValue("linear_solver", linear_solver);
+    serial = !MPC_NLP::ThreadSafe(linear_solver);
+}
+
+template <int N, int Order>
+bool MPC<N, Order>::Probe() {
+    State state;
+    state << 0, 0, 0, 0, 0, 0;
+    Coeffs coeffs = Coeffs::Zero(layout.order() + 1);
+    Backend saved = backend;
+    backend = IPOPT;
+    SolveResult result = Solve(state, coeffs);
+    backend = saved;
+    Reset();
+    return result.status == CppAD::ipopt::solve_result<Dvector>::success ||
+        result.status == CppAD::ipopt::solve_result<Dvector>::stop_at_acceptable_point;
+}
+
+// Bounds that do not depend on the telemetry. The config is fixed for the
+// life of the controller so they are written once; Solve only updates the
+// initial state.
+template <int N, int Order>
+void MPC<N, Order>::SetBounds() {
+    const size_t delta_start = layout.delta_start();
+    const size_t a_start = layout.a_start();
+    const size_t n_vars = layout.n_vars();
+    const size_t n_constraints = layout.n_constraints();
     
     // Lower and upper limits for x
-    Dvector vars_lowerbound(n_vars);
-    Dvector vars_upperbound(n_vars);
+    Dvector& vars_lowerbound = nlp->vars_lowerbound;
+    Dvector& vars_upperbound = nlp->vars_upperbound;
     
     // Set all non-actuators upper and lowerlimits
     // to the max negative and positive values.
@@ -235,26 +217,175 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     // degrees (values in radians).
     // NOTE: Feel free to change this to something else.
     for (int i = delta_start; i < a_start; i++) {
-        vars_lowerbound[i] = -0.436332;
-        vars_upperbound[i] = 0.436332;
+        vars_lowerbound[i] = -config.delta_max;
+        vars_upperbound[i] = config.delta_max;
     }
     
     // Acceleration/decceleration upper and lower limits.
     // NOTE: Feel free to change this to something else.
     for (int i = a_start; i < n_vars; i++) {
-        vars_lowerbound[i] = -1.0;
-        vars_upperbound[i] = 1.0;
+        vars_lowerbound[i] = -config.a_max;
+        vars_upperbound[i] = config.a_max;
     }
     
     // Lower and upper limits for constraints
     // All of these should be 0 except the initial
     // state indices.
-    Dvector constraints_lowerbound(n_constraints);
-    Dvector constraints_upperbound(n_constraints);
+    Dvector& constraints_lowerbound = nlp->constraints_lowerbound;
+    Dvector& constraints_upperbound = nlp->constraints_upperbound;
     for (int i = 0; i < n_constraints; i++) {
         constraints_lowerbound[i] = 0;
         constraints_upperbound[i] = 0;
     }
+}
+
+// Shift a block of `len` values starting at `start` by `shift` steps,
+// repeating the last value at the tail.
+static void ShiftBlock(const MPC_NLP::Dvector& from, MPC_NLP::Dvector& to,
+                       size_t start, size_t len, size_t shift) {
+    for (size_t t = 0; t < len; t++) {
+        size_t k = min(t + shift, len - 1);
+        to[start + t] = from[start + k];
+    }
+}
+
+// Shift a trajectory by `shift` steps, repeating the last value at the tail.
+//
+// The previous trajectory is in the car frame of the previous tick, so x, y
+// and psi are moved to the frame of the state it predicted for now.
+template <class Layout>
+static void ShiftTrajectory(const Layout& layout, const MPC_NLP::Dvector& prev,
+                            MPC_NLP::Dvector& vars, size_t shift) {
+    const size_t N = layout.size();
+    size_t s = min(shift, N - 1);
+    double x0 = prev[layout.x_start() + s];
+    double y0 = prev[layout.y_start() + s];
+    double psi0 = prev[layout.psi_start() + s];
+    for (size_t t = 0; t < N; t++) {
+        size_t k = min(t + s, N - 1);
+        double dx = prev[layout.x_start() + k] - x0;
+        double dy = prev[layout.y_start() + k] - y0;
+        vars[layout.x_start() + t] = cos(psi0) * dx + sin(psi0) * dy;
+        vars[layout.y_start() + t] = -sin(psi0) * dx + cos(psi0) * dy;
+        vars[layout.psi_start() + t] = prev[layout.psi_start() + k] - psi0;
+    }
+    ShiftBlock(prev, vars, layout.v_start(), N, s);
+    ShiftBlock(prev, vars, layout.cte_start(), N, s);
+    ShiftBlock(prev, vars, layout.epsi_start(), N, s);
+    ShiftBlock(prev, vars, layout.delta_start(), N - 1, s);
+    ShiftBlock(prev, vars, layout.a_start(), N - 1, s);
+}
+
+// Build the initial point and multipliers from the previous solution,
+// shifted by `shift` steps.
+template <int N, int Order>
+void MPC<N, Order>::WarmStart(size_t shift) {
+    ShiftTrajectory(layout, solution.x, nlp->vars, shift);
+    size_t s = min(shift, layout.size() - 1);
+    
+    // Bound multipliers follow the variables, constraint multipliers are
+    // laid out like the states.
+    size_t starts[] = {layout.x_start(), layout.y_start(), layout.psi_start(),
+        layout.v_start(), layout.cte_start(), layout.epsi_start()};
+    for (size_t i = 0; i < 6; i++) {
+        ShiftBlock(solution.zl, nlp->z_lower, starts[i], layout.size(), s);
+        ShiftBlock(solution.zu, nlp->z_upper, starts[i], layout.size(), s);
+        ShiftBlock(solution.lambda, nlp->lambda, starts[i], layout.size(), s);
+    }
+    ShiftBlock(solution.zl, nlp->z_lower, layout.delta_start(), layout.size() - 1, s);
+    ShiftBlock(solution.zu, nlp->z_upper, layout.delta_start(), layout.size() - 1, s);
+    ShiftBlock(solution.zl, nlp->z_lower, layout.a_start(), layout.size() - 1, s);
+    ShiftBlock(solution.zu, nlp->z_upper, layout.a_start(), layout.size() - 1, s);
+}
+
+
+template <int N, int Order>
+typename MPC<N, Order>::SolveResult MPC<N, Order>::Solve(const State& state, const Coeffs& coeffs) {
+    Clock::time_point start = Clock::now();
+    Trace::Scope trace("solve");
+
+    const size_t x_start = layout.x_start();
+    const size_t y_start = layout.y_start();
+    const size_t psi_start = layout.psi_start();
+    const size_t v_start = layout.v_start();
+    const size_t cte_start = layout.cte_start();
+    const size_t epsi_start = layout.epsi_start();
+    const size_t delta_start = layout.delta_start();
+    const size_t a_start = layout.a_start();
+    
+    double x = state[0];
+    double y = state[1];
+    double psi = state[2];
+    double v = state[3];
+    double cte = state[4];
+    double epsi = state[5];
+    
+    // Supose we are at x = 0 because that is our frame of reference
+    // We compute the direction of the pol. at x = v * dt* N
+    
+    double lx = v * config.dt * layout.size();
+    double f, deriv, d2f;
+    Model::PolyDerivatives(coeffs.data(), layout.order(), lx, f, deriv, d2f);
+    double psil = atan(deriv);
+    
+    // We use a simple algoritm to set speed. That way in straight roads
+    // we go fast and in bends we slow.
+    
+    ref_v = (config.max_v - config.min_v) * (1 - fabs(psil)*config.dec_factor/M_PI) + config.min_v;
+    
+    //
+    // Incorporate latency
+    //
+    int step = floor(config.latency/config.dt);
+    
+    if (backend == RTI) {
+        Profile::Mark rti_start = Profile::Start();
+        solution.obj_value = SolveRTI(state, coeffs);
+        Profile::Since(Profile::RTI, rti_start);
+        solution.x = rti.vars;
+        solution.status = CppAD::ipopt::solve_result<Dvector>::success;
+        return Result(step, rti.qp_iterations, false, start);
+    }
+    
+    // One thread at a time may run Ipopt with MUMPS, see MPC_NLP::mutex
+    std::unique_lock<std::mutex> lock(MPC_NLP::mutex, std::defer_lock);
+    if (serial) {
+        Profile::Mark lock_start = Profile::Start();
+        lock.lock();
+        Profile::Since(Profile::LOCK, lock_start);
+    }
+    // The deadline is Ipopt's, it does not count the wait for the lock
+    Clock::time_point locked = Clock::now();
+    const size_t n_vars = layout.n_vars();
+    
+    // Update the dynamic parameters of the tape
+    for (int i = 0; i <= layout.order(); i++) {
+        params[i] = coeffs[i];
+    }
+    params[layout.ref_v_param()] = ref_v;
+    {
+        Profile::Scope scope(Profile::TAPE);
+        nlp->SetParameters(params);
+    }
+    
+    // Initial value of the independent variables.
+    // Should be 0 except for the initial values.
+    Dvector& vars = nlp->vars;
+    for (int i = 0; i < n_vars; i++) {
+        vars[i] = 0.0;
+    }
+    // Set the initial variable values
+    vars[x_start] = x;
+    vars[y_start] = y;
+    vars[psi_start] = psi;
+    vars[v_start] = v;
+    vars[cte_start] = cte;
+    vars[epsi_start] = epsi;
+    
+    // Only the initial state changes in the bounds, the rest is written
+    // once by SetBounds.
+    Dvector& constraints_lowerbound = nlp->constraints_lowerbound;
+    Dvector& constraints_upperbound = nlp->constraints_upperbound;
     constraints_lowerbound[x_start] = x;
     constraints_lowerbound[y_start] = y;
     constraints_lowerbound[psi_start] = psi;
@@ -269,40 +400,263 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     constraints_upperbound[cte_start] = cte;
     constraints_upperbound[epsi_start] = epsi;
     
-    // Object that computes objective and constraints
-    FG_eval fg_eval(coeffs);
-    
-    // options
-    std::string options;
-    options += "Integer print_level  0\n";
-    options += "Sparse  true        forward\n";
-    options += "Sparse  true        reverse\n";
-    // place to return solution
-    //CppAD::ipopt::solve_result<Dvector> solution;
-    
-    
-    // solve the problem
-    CppAD::ipopt::solve<Dvector, FG_eval>(
-                                          options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-                                          constraints_upperbound, fg_eval, solution);
+    // Start from the previous solution if we have a good one
+    bool warm = warm_start && solution.x.size() == n_vars &&
+        (solution.status == CppAD::ipopt::solve_result<Dvector>::success ||
+         solution.status == CppAD::ipopt::solve_result<Dvector>::stop_at_acceptable_point);
+    if (warm) {
+        WarmStart(1 + step);
+        vars[x_start] = x;
+        vars[y_start] = y;
+        vars[psi_start] = psi;
+        vars[v_start] = v;
+        vars[cte_start] = cte;
+        vars[epsi_start] = epsi;
+    }
+    if (warm != ipopt_warm_start) {
+        app->Options()->SetStringValue("warm_start_init_point", warm ? "yes" : "no");
+        ipopt_warm_start = warm;
+    }
+    nlp->warm_start = warm;
+    
+    nlp->use_deadline = deadline > 0;
+    nlp->deadline = locked + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(deadline));
+    nlp->deadline_hit = false;
+    
+    // solve the problem reusing the recorded tape
+    {
+        nlp->eval_time = 0;
+        nlp->eval_counters = PerfCounters::Values();
+        Profile::Mark ipopt_start = Profile::Start();
+        nlp->iteration_start = ipopt_start.time;
+
+        // Left as is when Ipopt fails before it solves, say for a linear
+        // solver it was built without
+        solution.status = CppAD::ipopt::solve_result<Dvector>::not_defined;
+        {
+            // Not Ipopt's own allocations, the callbacks count theirs
+            AllocationCounter::Pause pause;
+            app->OptimizeTNLP(nlp);
+        }
+        uint64_t ipopt_end = Profile::Now();
+        uint64_t ipopt_time = ipopt_end - ipopt_start.time;
+        Trace::Complete("optimize", ipopt_start.time, ipopt_end);
+        Profile::Add(Profile::EVAL, nlp->eval_time);
+        Profile::Add(Profile::IPOPT, ipopt_time - std::min(ipopt_time, nlp->eval_time));
+        if (PerfCounters::Enabled()) {
+            // What the evaluations did not count is Ipopt's own, mostly
+            // the linear solves
+            PerfCounters::Values end;
+            PerfCounters::Read(end);
+            for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+                end.value[i] -= nlp->eval_counters.value[i];
+            }
+            Profile::AddCounters(Profile::IPOPT, ipopt_start.counters, end);
+            Profile::AddCounters(Profile::EVAL, PerfCounters::Values(), nlp->eval_counters);
+        }
+    }
+    if (nlp->deadline_hit) {
+        deadline_misses++;
+    }
     
-    //
-    // Check some of the solution values
-    //
-    bool ok = true;
-    ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
+    // Keep the point Ipopt stopped at if it converged or at least meets the
+    // constraints. Otherwise drive the previous plan, shifted to now, or
+    // with no plan yet steer straight and coast, never the failed iterate.
+    bool fallback = false;
+    bool converged = solution.status == CppAD::ipopt::solve_result<Dvector>::success ||
+        solution.status == CppAD::ipopt::solve_result<Dvector>::stop_at_acceptable_point;
+    if (converged || Feasible()) {
+        plan = solution.x;
+        plan_valid = true;
+    } else if (plan_valid) {
+        ShiftTrajectory(layout, plan, solution.x, 1 + step);
+        plan = solution.x;
+        nlp->eval_f(n_vars, solution.x.data(), true, solution.obj_value);
+        fallback = true;
+        fallbacks++;
+    } else {
+        solution.x.resize(n_vars);
+        const size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+        for (size_t i = 0; i < 6; i++) {
+            for (size_t t = 0; t < layout.size(); t++) {
+                solution.x[starts[i] + t] = state[i];
+            }
+        }
+        for (size_t i = delta_start; i < n_vars; i++) {
+            solution.x[i] = 0.0;
+        }
+        nlp->eval_f(n_vars, solution.x.data(), true, solution.obj_value);
+        fallback = true;
+        fallbacks++;
+    }
     
-    auto cost = solution.obj_value;
-    //std::cout << "Cost " << cost << std::endl;
+    // Run RTI on the same problem to check it against Ipopt
+    if (backend == COMPARE) {
+        {
+            Profile::Scope scope(Profile::RTI);
+            SolveRTI(state, coeffs);
+        }
+        rti_steer_diff = fabs(rti.vars[delta_start + step] - solution.x[delta_start + step]);
+        rti_throttle_diff = fabs(rti.vars[a_start + step] - solution.x[a_start + step]);
+        rti_max_steer_diff = max(rti_max_steer_diff, rti_steer_diff);
+        rti_max_throttle_diff = max(rti_max_throttle_diff, rti_throttle_diff);
+    }
     
-    //
-    // Incorporate latency
-    //
-    double latency = 0.1;
-    int step = floor(latency/dt);
-    return {solution.x[x_start + 1+step],   solution.x[y_start + 1+step],
-        solution.x[psi_start + 1+step], solution.x[v_start + 1+step],
-        solution.x[cte_start + 1+step], solution.x[epsi_start + 1+step],
-        solution.x[delta_start+step],   solution.x[a_start+step], cost};
+    return Result(step, nlp->iterations, fallback, start);
+}
+
+// The actuations `step` steps from now and the trajectory of `solution`
+template <int N, int Order>
+typename MPC<N, Order>::SolveResult MPC<N, Order>::Result(int step, int iterations,
+                                                          bool fallback, Clock::time_point start) {
+    SolveResult result(solution.x, layout);
+    result.steer = solution.x[layout.delta_start() + step];
+    result.throttle = solution.x[layout.a_start() + step];
+    result.cost = solution.obj_value;
+    result.status = solution.status;
+    result.iterations = iterations;
+    result.solve_time = std::chrono::duration<double>(Clock::now() - start).count();
+    result.fallback = fallback;
+    return result;
+}
+
+// Whether the point Ipopt stopped at is within the bounds and meets the
+// constraints, to a looser tolerance than convergence
+template <int N, int Order>
+bool MPC<N, Order>::Feasible() const {
+    const double tol = 1e-4;
+    if (solution.x.size() != layout.n_vars() || solution.g.size() != layout.n_constraints()) {
+        return false;
+    }
+    for (size_t i = 0; i < layout.n_vars(); i++) {
+        if (!(solution.x[i] >= nlp->vars_lowerbound[i] - tol &&
+              solution.x[i] <= nlp->vars_upperbound[i] + tol)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < layout.n_constraints(); i++) {
+        if (!(solution.g[i] >= nlp->constraints_lowerbound[i] - tol &&
+              solution.g[i] <= nlp->constraints_upperbound[i] + tol)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Preparation phase of RTI, to be run between ticks. Shifts the last RTI
+// solution and linearizes around it.
+template <int N, int Order>
+void MPC<N, Order>::Prepare() {
+    if (backend == IPOPT || !rti_valid || rti.prepared) {
+        return;
+    }
+    int step = floor(config.latency/config.dt);
+    ShiftTrajectory(layout, rti.vars, shifted, 1 + step);
+    rti.vars = shifted;
+    rti.Prepare();
+}
+
+template <int N, int Order>
+void MPC<N, Order>::Reset() {
+    solution.status = CppAD::ipopt::solve_result<Dvector>::not_defined;
+    plan_valid = false;
+    rti_valid = false;
+    rti.prepared = false;
+    deadline_misses = 0;
+    fallbacks = 0;
+    rti_steer_diff = 0;
+    rti_throttle_diff = 0;
+    rti_max_steer_diff = 0;
+    rti_max_throttle_diff = 0;
+}
+
+template <int N, int Order>
+void MPC<N, Order>::SetKKT(MPC_RTI::KKT kkt) {
+    rti.SetKKT(kkt);
+}
+
+template <int N, int Order>
+void MPC<N, Order>::SetDerivatives(Derivatives derivatives) {
+    if (derivatives == GENERATED && layout.order() != KERNEL_ORDER) {
+        derivatives = ANALYTIC;
+    }
+    switch (derivatives) {
+        case ANALYTIC:
+            nlp->SetDerivatives(&analytic);
+            break;
+        case GENERATED:
+            nlp->SetDerivatives(&generated);
+            break;
+        default:
+            nlp->SetDerivatives(NULL);
+    }
+}
+
+static double Uniform(double lo, double hi) {
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+template <int N, int Order>
+double MPC<N, Order>::CheckDerivatives(int trials) {
+    size_t n_vars = layout.n_vars();
+    size_t n_constraints = layout.n_constraints();
+    Dvector x(n_vars);
+    Dvector lambda(n_constraints);
+    
+    // Typical size of each coefficient of the fitted polynomial
+    double scale[] = {5, 1, 0.05, 0.001};
+    
+    double err = 0.0;
+    for (int k = 0; k < trials; k++) {
+        for (int i = 0; i <= layout.order(); i++) {
+            double s = i < 4 ? scale[i] : scale[3] * pow(0.02, i - 3);
+            params[i] = Uniform(-s, s);
+        }
+        params[layout.ref_v_param()] = Uniform(config.min_v, config.max_v);
+        for (size_t i = 0; i < n_vars; i++) {
+            x[i] = Uniform(-1, 1);
+        }
+        for (size_t t = 0; t < layout.size(); t++) {
+            x[layout.x_start() + t] = Uniform(0, 50);
+            x[layout.y_start() + t] = Uniform(-5, 5);
+            x[layout.v_start() + t] = Uniform(0, config.max_v);
+            x[layout.cte_start() + t] = Uniform(-5, 5);
+        }
+        for (size_t i = 0; i < n_constraints; i++) {
+            lambda[i] = Uniform(-10, 10);
+        }
+        double obj_factor = Uniform(0, 1);
+        err = max(err, nlp->CheckDerivatives(analytic, params, x, obj_factor, lambda));
+        if (layout.order() == KERNEL_ORDER) {
+            err = max(err, nlp->CheckDerivatives(generated, params, x, obj_factor, lambda));
+        }
+    }
+    return err;
+}
+
+// Feedback phase of RTI. Returns the cost.
+template <int N, int Order>
+double MPC<N, Order>::SolveRTI(const State& state, const Coeffs& coeffs) {
+    if (!rti.prepared) {
+        if (rti_valid) {
+            Prepare();
+        } else {
+            // First tick, start from going straight at constant speed
+            for (size_t i = 0; i < rti.vars.size(); i++) {
+                rti.vars[i] = 0.0;
+            }
+            for (size_t t = 0; t < layout.size(); t++) {
+                rti.vars[layout.x_start() + t] = state[3] * config.dt * t;
+                rti.vars[layout.v_start() + t] = state[3];
+            }
+            rti.Prepare();
+        }
+    }
+    double cost = rti.Feedback(state, coeffs, ref_v);
+    rti_valid = true;
+    return cost;
 }
 
+template class MPC<15, 3>;
+template class MPC<Eigen::Dynamic, Eigen::Dynamic>;
@@ -2,29 +2,231 @@
 #define MPC_H
 
 #include <vector>
+#include <chrono>
 #include "Eigen-3.3/Eigen/Core"
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
+#include "MPCConfig.h"
+#include "MPC_Model.h"
+#include "MPC_NLP.h"
+#include "MPC_RTI.h"
+#include "MPC_Analytic.h"
+#include "MPC_Generated.h"
 
 using namespace std;
-// TODO: Set the timestep length and duration
 
+// Horizon of the problem. A fixed N makes it a compile time constant,
+// Eigen::Dynamic takes it from the config.
+template <int N>
+struct MPCHorizon {
+    explicit MPCHorizon(const MPCConfig&) {}
+    static constexpr size_t size() { return N; }
+};
+
+template <>
+struct MPCHorizon<Eigen::Dynamic> {
+    explicit MPCHorizon(const MPCConfig& config) : n(config.N) {}
+    size_t size() const { return n; }
+private:
+    size_t n;
+};
+
+// Order of the fitted polynomial, same as MPCHorizon
+template <int Order>
+struct MPCOrder {
+    explicit MPCOrder(const MPCConfig&) {}
+    static constexpr int order() { return Order; }
+};
+
+template <>
+struct MPCOrder<Eigen::Dynamic> {
+    explicit MPCOrder(const MPCConfig& config) : n(config.order) {}
+    int order() const { return n; }
+private:
+    int n;
+};
+
+// Offsets of the variables, as in MPCConfig. They are constant expressions
+// when N is fixed so the loops over the stages can be unrolled.
+template <int N, int Order>
+struct MPCLayout : MPCHorizon<N>, MPCOrder<Order> {
+    explicit MPCLayout(const MPCConfig& config)
+        : MPCHorizon<N>(config), MPCOrder<Order>(config) {}
+
+    constexpr size_t x_start() const { return 0; }
+    constexpr size_t y_start() const { return this->size(); }
+    constexpr size_t psi_start() const { return 2 * this->size(); }
+    constexpr size_t v_start() const { return 3 * this->size(); }
+    constexpr size_t cte_start() const { return 4 * this->size(); }
+    constexpr size_t epsi_start() const { return 5 * this->size(); }
+    constexpr size_t delta_start() const { return 6 * this->size(); }
+    constexpr size_t a_start() const { return 7 * this->size() - 1; }
+    constexpr size_t n_vars() const { return 8 * this->size() - 2; }
+    constexpr size_t n_constraints() const { return 6 * this->size(); }
+    constexpr size_t n_params() const { return this->order() + 2; }
+    constexpr size_t ref_v_param() const { return this->order() + 1; }
+};
 
+// Model predictive controller over a horizon of N steps with a polynomial
+// of order Order fitted to the waypoints. Either can be Eigen::Dynamic to
+// take it from the MPCConfig given to the constructor; when fixed they
+// override it.
+//
+// MPC.cpp instantiates MPC<15, 3> and MPC<Eigen::Dynamic, Eigen::Dynamic>.
+
+template <int N = 15, int Order = 3>
 class MPC {
  public:
     typedef CPPAD_TESTVECTOR(double) Dvector;
+    typedef MPCLayout<N, Order> Layout;
+
+    // x, y, psi, v, cte, epsi
+    typedef Eigen::Matrix<double, Model::N_STATE, 1> State;
+
+    // Coefficients of the fitted polynomial, lowest power first
+    typedef Eigen::Matrix<double, Order == Eigen::Dynamic ? Eigen::Dynamic : Order + 1, 1> Coeffs;
+
+    typedef CppAD::ipopt::solve_result<Dvector>::status_type Status;
+    typedef std::chrono::steady_clock Clock;
+
+    // View of one variable of the predicted trajectory
+    typedef Eigen::Map<const Eigen::Matrix<double, N, 1> > Trajectory;
+
+    // What Solve returns. The trajectories are views into `solution.x`,
+    // valid until the next call to Solve.
+    struct SolveResult {
+        double steer;       // delta, radians
+        double throttle;    // a
+        double cost;
+        Status status;
+        int iterations;     // of Ipopt, or of the RTI QP
+        double solve_time;  // seconds
+        bool fallback;      // Ipopt failed, this is the previous plan shifted, or
+                            // no steering or throttle when there is none
+
+        Trajectory x;
+        Trajectory y;
+        Trajectory psi;
+        Trajectory v;
+
+        SolveResult(const Dvector& vars, const Layout& layout)
+            : x(vars.data() + layout.x_start(), layout.size()),
+              y(vars.data() + layout.y_start(), layout.size()),
+              psi(vars.data() + layout.psi_start(), layout.size()),
+              v(vars.data() + layout.v_start(), layout.size()) {}
+    };
+
+    // Horizon, model and tuning
+    const MPCConfig config;
+    const Layout layout;
+
    // place to return solution
     CppAD::ipopt::solve_result<Dvector> solution;
+    
+    // Ipopt problem with the recorded tape, reused between calls
+    Ipopt::SmartPtr<MPC_NLP> nlp;
+    Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+    Dvector params;
+    
+    // Reference speed of the last solve, from the speed regulator
+    double ref_v;
+    
+    // Start each solve from the previous solution shifted by one step
+    // plus the latency, and reuse its multipliers.
+    bool warm_start;
+    
+    // Solver used by Solve
+    enum Backend {
+        IPOPT,      // Ipopt run to convergence
+        RTI,        // one real time iteration per tick, see MPC_RTI.h
+        COMPARE     // Ipopt, and RTI alongside to check it
+    };
+    Backend backend;
+    
+    // Wall clock budget of an Ipopt solve in seconds, none when 0. A solve
+    // that runs out of it stops at its current iterate, which is used if
+    // it is feasible; otherwise, as when Ipopt fails, the plan of the
+    // previous tick is shifted to now, or before there is one the wheel is
+    // held straight with no throttle. RTI is bounded by its QP iterations.
+    double deadline;
+    
+    // Solves stopped by the deadline, and solves that returned the shifted
+    // previous plan or no actuation
+    size_t deadline_misses;
+    size_t fallbacks;
+    
+    // Differences between the RTI and Ipopt actuations in COMPARE, of the
+    // last solve and the largest ones
+    double rti_steer_diff;
+    double rti_throttle_diff;
+    double rti_max_steer_diff;
+    double rti_max_throttle_diff;
+    
+    // How Ipopt gets the derivatives
+    enum Derivatives {
+        TAPE,       // the recorded CppAD tape
+        ANALYTIC,   // hand-coded, see MPC_Analytic.h
+        GENERATED   // generated at build time, see MPC_Kernel.h. Only for
+                    // polynomials of KERNEL_ORDER, ANALYTIC is used otherwise.
+    };
 
-  MPC();
+  explicit MPC(const MPCConfig& config = MPCConfig());
 
   virtual ~MPC();
     
     
 
   // Solve the model given an initial state and polynomial coefficients.
-  // Return the first actuatotions.
-  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  // Return the actuations to apply `latency` from now and the predicted
+  // trajectory. Solve does not allocate once the solver is warm.
+  SolveResult Solve(const State& state, const Coeffs& coeffs);
+    
+  // RTI preparation phase. Call it between ticks, after sending the
+  // actuations, so Solve only has to run the feedback phase.
+  void Prepare();
+
+  // Forget the previous solutions and the counters, so the next Solve
+  // starts cold as on a new controller. The tape, Ipopt and the buffers
+  // stay warm.
+  void Reset();
+
+  // How the RTI QP Newton steps are computed, RICCATI by default
+  void SetKKT(MPC_RTI::KKT kkt);
+
+  // Derivatives used by Ipopt, GENERATED by default
+  void SetDerivatives(Derivatives derivatives);
+
+  // Linear solver of Ipopt, "mumps" by default. Solves with one that is
+  // not MPC_NLP::ThreadSafe take turns with those of other controllers.
+  void SetLinearSolver(const std::string& linear_solver);
+
+  // Whether Ipopt solves with the linear solver set: one solve from rest
+  // on a straight road. Ipopt fails when the solver is not built in.
+  bool Probe();
+
+  // Largest difference between the tape and the analytic or generated
+  // derivatives at `trials` random points
+  double CheckDerivatives(int trials);
+    
+ private:
+  MPC_RTI rti;
+  MPC_Analytic analytic;
+  MPC_Generated generated;
+  bool rti_valid;
+  Dvector shifted;
+  bool ipopt_warm_start;     // last warm_start_init_point given to Ipopt
+  Dvector plan;              // last usable Ipopt solution, for the fallback
+  bool plan_valid;
+  bool serial;               // the linear solver is not thread safe
+    
+  void SetBounds();
+  bool Feasible() const;
+  void WarmStart(size_t shift);
+  double SolveRTI(const State& state, const Coeffs& coeffs);
+  SolveResult Result(int step, int iterations, bool fallback, Clock::time_point start);
 };
 
+extern template class MPC<15, 3>;
+extern template class MPC<Eigen::Dynamic, Eigen::Dynamic>;
+
 #endif /* MPC_H */
@@ -0,0 +1,70 @@
+#ifndef MPC_CONFIG_H
+#define MPC_CONFIG_H
+
+#include <stddef.h>
+
+// Horizon, model and tuning of a controller.
+//
+// The solver takes all the state variables and actuator variables in a
+// singular vector: N values of x, y, psi, v, cte and epsi followed by N - 1
+// values of delta and a. The *_start functions give where each one starts.
+
+struct MPCConfig {
+    size_t N;           // timesteps, N - 1 actuations
+    double dt;
+    int order;          // of the fitted polynomial
+
+    // Latency of the actuators. The actuations returned by Solve are the
+    // ones planned for this time from now.
+    double latency;
+
+    // This value assumes the model presented in the classroom is used.
+    //
+    // It was obtained by measuring the radius formed by running the vehicle
+    // in the simulator around in a circle with a constant steering angle and
+    // velocity on a flat terrain.
+    //
+    // Lf was tuned until the the radius formed by the simulating the model
+    // presented in the classroom matched the previous radius.
+    //
+    // This is the length from front to CoG that has a similar radius.
+    double Lf;
+
+    // Parameters for speed regulator.
+    //  When te road is straight we try to get maximum speed
+    //  When it mades turns we reduce speed according the factor.
+    //  A factor of 2 means reduce to halve speed when road turns 45º
+    // Minimum speed is the minimum speed to drive
+    double max_v;
+    double min_v;
+    double dec_factor;
+
+    // Weights of the actuations in the cost and their limits
+    double w_delta;     // delta^2
+    double w_ddelta;    // change of delta between steps
+    double delta_max;   // radians
+    double a_max;
+
+    // Some values : N 25, dt 0.05 // Coefs 50/150, till 0, 2500
+    MPCConfig()
+        : N(15), dt(0.05), order(3), latency(0.1), Lf(2.67), max_v(100.0), min_v(45.0),
+          dec_factor(2.0), w_delta(150), w_ddelta(2000.0), delta_max(0.436332), a_max(1.0) {}
+
+    size_t x_start() const { return 0; }
+    size_t y_start() const { return N; }
+    size_t psi_start() const { return 2 * N; }
+    size_t v_start() const { return 3 * N; }
+    size_t cte_start() const { return 4 * N; }
+    size_t epsi_start() const { return 5 * N; }
+    size_t delta_start() const { return 6 * N; }
+    size_t a_start() const { return 7 * N - 1; }
+    size_t n_vars() const { return 8 * N - 2; }
+    size_t n_constraints() const { return 6 * N; }
+
+    // Dynamic parameters of the problem: the coefficients of the fitted
+    // polynomial followed by the reference speed.
+    size_t n_params() const { return order + 2; }
+    size_t ref_v_param() const { return order + 1; }
+};
+
+#endif /* MPC_CONFIG_H */
@@ -0,0 +1,302 @@
+#include "MPC_Analytic.h"
+#include "MPC_Model.h"
+#include <math.h>
+
+MPC_Analytic::MPC_Analytic(const MPCConfig& config)
+    : p(config), coeffs(config.order + 1, 0.0), ref_v(0) {
+    x_start = p.x_start();
+    y_start = p.y_start();
+    psi_start = p.psi_start();
+    v_start = p.v_start();
+    cte_start = p.cte_start();
+    epsi_start = p.epsi_start();
+    delta_start = p.delta_start();
+    a_start = p.a_start();
+}
+
+MPC_Analytic::~MPC_Analytic() {}
+
+// The Jacobian has the 6 initial rows followed, for each step, by
+//    x:    x1, x0, psi0, v0
+//    y:    y1, y0, psi0, v0
+//    psi:  psi1, psi0, v0, delta0
+//    v:    v1, v0, a0
+//    cte:  cte1, x0, y0, psi0, v0
+//    epsi: epsi1, x0, psi0, v0, delta0
+//
+// The Hessian has, for each step, the 7 entries of the dynamics in
+// x0, psi0, v0 and delta0, then the diagonal of the cost and the coupling
+// of consecutive actuations.
+
+void MPC_Analytic::Structure(SizeVector& jac_row, SizeVector& jac_col,
+                             SizeVector& hes_row, SizeVector& hes_col) {
+    size_t N = p.N;
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+
+    jac_row.resize(6 + 25 * (N - 1));
+    jac_col.resize(jac_row.size());
+    size_t k = 0;
+    for (size_t i = 0; i < 6; i++) {
+        jac_row[k] = starts[i];
+        jac_col[k++] = starts[i];
+    }
+    for (size_t t = 1; t < N; t++) {
+        size_t x0 = x_start + t - 1, y0 = y_start + t - 1, psi0 = psi_start + t - 1;
+        size_t v0 = v_start + t - 1, delta0 = delta_start + t - 1, a0 = a_start + t - 1;
+        size_t cols[25] = {x_start + t, x0, psi0, v0,
+                           y_start + t, y0, psi0, v0,
+                           psi_start + t, psi0, v0, delta0,
+                           v_start + t, v0, a0,
+                           cte_start + t, x0, y0, psi0, v0,
+                           epsi_start + t, x0, psi0, v0, delta0};
+        size_t rows[25] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3,
+                           4, 4, 4, 4, 4, 5, 5, 5, 5, 5};
+        for (size_t i = 0; i < 25; i++) {
+            jac_row[k] = starts[rows[i]] + t;
+            jac_col[k++] = cols[i];
+        }
+    }
+
+    hes_row.resize(7 * (N - 1) + 1 + 2 * N + 2 * (N - 1) + 2 * (N - 2));
+    hes_col.resize(hes_row.size());
+    k = 0;
+    for (size_t t = 0; t < N - 1; t++) {
+        size_t x0 = x_start + t, psi0 = psi_start + t, v0 = v_start + t, delta0 = delta_start + t;
+        size_t rows[7] = {x0, psi0, psi0, v0, v0, v0, delta0};
+        size_t cols[7] = {x0, x0, psi0, x0, psi0, v0, v0};
+        for (size_t i = 0; i < 7; i++) {
+            hes_row[k] = rows[i];
+            hes_col[k++] = cols[i];
+        }
+    }
+    hes_row[k] = v_start + N - 1;
+    hes_col[k++] = v_start + N - 1;
+    for (size_t t = 0; t < N; t++) {
+        hes_row[k] = cte_start + t;
+        hes_col[k++] = cte_start + t;
+        hes_row[k] = epsi_start + t;
+        hes_col[k++] = epsi_start + t;
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        hes_row[k] = delta_start + t;
+        hes_col[k++] = delta_start + t;
+        hes_row[k] = a_start + t;
+        hes_col[k++] = a_start + t;
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        hes_row[k] = delta_start + t + 1;
+        hes_col[k++] = delta_start + t;
+        hes_row[k] = a_start + t + 1;
+        hes_col[k++] = a_start + t;
+    }
+}
+
+void MPC_Analytic::SetParameters(const Dvector& params) {
+    for (int i = 0; i <= p.order; i++) {
+        coeffs[i] = params[i];
+    }
+    ref_v = params[p.order + 1];
+}
+
+double MPC_Analytic::Cost(const double* x) {
+    size_t N = p.N;
+    double cost = 0.0;
+    for (size_t t = 0; t < N; t++) {
+        cost += x[cte_start + t] * x[cte_start + t];
+        cost += x[epsi_start + t] * x[epsi_start + t];
+        cost += (x[v_start + t] - ref_v) * (x[v_start + t] - ref_v);
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        cost += p.w_delta * x[delta_start + t] * x[delta_start + t];
+        cost += x[a_start + t] * x[a_start + t];
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        double dd = x[delta_start + t + 1] - x[delta_start + t];
+        double da = x[a_start + t + 1] - x[a_start + t];
+        cost += p.w_ddelta * dd * dd;
+        cost += da * da;
+    }
+    return cost;
+}
+
+void MPC_Analytic::Gradient(const double* x, double* grad) {
+    size_t N = p.N;
+    for (size_t i = 0; i < cte_start; i++) {
+        grad[i] = 0.0;
+    }
+    for (size_t t = 0; t < N; t++) {
+        grad[v_start + t] = 2 * (x[v_start + t] - ref_v);
+        grad[cte_start + t] = 2 * x[cte_start + t];
+        grad[epsi_start + t] = 2 * x[epsi_start + t];
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        grad[delta_start + t] = 2 * p.w_delta * x[delta_start + t];
+        grad[a_start + t] = 2 * x[a_start + t];
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        double dd = 2 * p.w_ddelta * (x[delta_start + t + 1] - x[delta_start + t]);
+        double da = 2 * (x[a_start + t + 1] - x[a_start + t]);
+        grad[delta_start + t + 1] += dd;
+        grad[delta_start + t] -= dd;
+        grad[a_start + t + 1] += da;
+        grad[a_start + t] -= da;
+    }
+}
+
+void MPC_Analytic::Constraints(const double* x, double* g) {
+    size_t N = p.N;
+    double dt = p.dt;
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (size_t i = 0; i < 6; i++) {
+        g[starts[i]] = x[starts[i]];
+    }
+    for (size_t t = 1; t < N; t++) {
+        double x0 = x[x_start + t - 1];
+        double y0 = x[y_start + t - 1];
+        double psi0 = x[psi_start + t - 1];
+        double v0 = x[v_start + t - 1];
+        double delta0 = x[delta_start + t - 1];
+        double a0 = x[a_start + t - 1];
+        double c = cos(psi0);
+        double s = sin(psi0);
+
+        // The polynomial at x01 and the heading slope, its coefficients
+        // shifted down one power, at x0 (see MPC_Model.h)
+        double x01 = x0 + v0 * c * dt;
+        double f1, df1, d2f1, q, dq, d2q;
+        Model::PolyDerivatives(&coeffs[0], p.order, x01, f1, df1, d2f1);
+        Model::PolyDerivatives(&coeffs[1], p.order - 1, x0, q, dq, d2q);
+        double psides0 = atan(q);
+
+        g[x_start + t] = x[x_start + t] - (x0 + v0 * c * dt);
+        g[y_start + t] = x[y_start + t] - (y0 + v0 * s * dt);
+        g[psi_start + t] = x[psi_start + t] - (psi0 + v0 * delta0 / p.Lf * dt);
+        g[v_start + t] = x[v_start + t] - (v0 + a0 * dt);
+        g[cte_start + t] = x[cte_start + t] - (f1 - (y0 + v0 * s * dt));
+        g[epsi_start + t] = x[epsi_start + t] - ((psi0 - psides0) + v0 * delta0 / p.Lf * dt);
+    }
+}
+
+void MPC_Analytic::Jacobian(const double* x, double* values) {
+    size_t N = p.N;
+    double dt = p.dt;
+    size_t k = 0;
+    for (size_t i = 0; i < 6; i++) {
+        values[k++] = 1.0;
+    }
+    for (size_t t = 1; t < N; t++) {
+        double x0 = x[x_start + t - 1];
+        double psi0 = x[psi_start + t - 1];
+        double v0 = x[v_start + t - 1];
+        double delta0 = x[delta_start + t - 1];
+        double c = cos(psi0);
+        double s = sin(psi0);
+
+        // f'(x01) and psides0 = atan(q(x0))
+        double x01 = x0 + v0 * c * dt;
+        double f1, df1, d2f1, q, dq, d2q;
+        Model::PolyDerivatives(&coeffs[0], p.order, x01, f1, df1, d2f1);
+        Model::PolyDerivatives(&coeffs[1], p.order - 1, x0, q, dq, d2q);
+
+        // x
+        values[k++] = 1.0;
+        values[k++] = -1.0;
+        values[k++] = v0 * s * dt;
+        values[k++] = -c * dt;
+        // y
+        values[k++] = 1.0;
+        values[k++] = -1.0;
+        values[k++] = -v0 * c * dt;
+        values[k++] = -s * dt;
+        // psi
+        values[k++] = 1.0;
+        values[k++] = -1.0;
+        values[k++] = -delta0 / p.Lf * dt;
+        values[k++] = -v0 / p.Lf * dt;
+        // v
+        values[k++] = 1.0;
+        values[k++] = -1.0;
+        values[k++] = -dt;
+        // cte
+        values[k++] = 1.0;
+        values[k++] = -df1;
+        values[k++] = 1.0;
+        values[k++] = df1 * v0 * s * dt + v0 * c * dt;
+        values[k++] = -df1 * c * dt + s * dt;
+        // epsi
+        values[k++] = 1.0;
+        values[k++] = dq / (1 + q * q);
+        values[k++] = -1.0;
+        values[k++] = -delta0 / p.Lf * dt;
+        values[k++] = -v0 / p.Lf * dt;
+    }
+}
+
+void MPC_Analytic::Hessian(const double* x, double obj_factor, const double* lambda,
+                           double* values) {
+    size_t N = p.N;
+    double dt = p.dt;
+    size_t k = 0;
+
+    // Dynamics of step t, with the multipliers of the constraints at t + 1
+    for (size_t t = 0; t < N - 1; t++) {
+        double x0 = x[x_start + t];
+        double psi0 = x[psi_start + t];
+        double v0 = x[v_start + t];
+        double c = cos(psi0);
+        double s = sin(psi0);
+        double lx = lambda[x_start + t + 1];
+        double ly = lambda[y_start + t + 1];
+        double lpsi = lambda[psi_start + t + 1];
+        double lcte = lambda[cte_start + t + 1];
+        double lepsi = lambda[epsi_start + t + 1];
+
+        double x01 = x0 + v0 * c * dt;
+        double f1, df1, d2f1, q, dq, d2q;
+        Model::PolyDerivatives(&coeffs[0], p.order, x01, f1, df1, d2f1);
+        Model::PolyDerivatives(&coeffs[1], p.order - 1, x0, q, dq, d2q);
+        double d2atan = (d2q * (1 + q * q) - 2 * q * dq * dq) / ((1 + q * q) * (1 + q * q));
+
+        // x0 x0
+        values[k++] = lcte * -d2f1 + lepsi * d2atan;
+        // psi0 x0
+        values[k++] = lcte * d2f1 * v0 * s * dt;
+        // psi0 psi0
+        values[k++] = lx * v0 * c * dt + ly * v0 * s * dt +
+            lcte * (-d2f1 * v0 * v0 * s * s * dt * dt + df1 * v0 * c * dt - v0 * s * dt);
+        // v0 x0
+        values[k++] = lcte * -d2f1 * c * dt;
+        // v0 psi0
+        values[k++] = lx * s * dt - ly * c * dt +
+            lcte * (d2f1 * v0 * s * c * dt * dt + df1 * s * dt + c * dt);
+        // v0 v0, and the cost on v
+        values[k++] = lcte * -d2f1 * c * c * dt * dt + obj_factor * 2;
+        // delta0 v0
+        values[k++] = -(lpsi + lepsi) / p.Lf * dt;
+    }
+
+    // Cost
+    values[k++] = obj_factor * 2;
+    for (size_t t = 0; t < N; t++) {
+        values[k++] = obj_factor * 2;
+        values[k++] = obj_factor * 2;
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        double wd = 2 * p.w_delta;
+        double wa = 2;
+        if (t > 0) {
+            wd += 2 * p.w_ddelta;
+            wa += 2;
+        }
+        if (t < N - 2) {
+            wd += 2 * p.w_ddelta;
+            wa += 2;
+        }
+        values[k++] = obj_factor * wd;
+        values[k++] = obj_factor * wa;
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        values[k++] = obj_factor * -2 * p.w_ddelta;
+        values[k++] = obj_factor * -2;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef MPC_ANALYTIC_H
+#define MPC_ANALYTIC_H
+
+#include <vector>
+#include "MPC_Derivatives.h"
+
+// Hand-coded derivatives of the problem FG_eval encodes.
+//
+// Each step of the dynamics only involves x, y, psi, v, delta and a at t
+// and the state at t + 1, so the Jacobian and the Hessian are evaluated
+// stage by stage in closed form: sin and cos of psi, products with v and
+// delta, the fitted polynomial and atan of the heading slope.
+
+class MPC_Analytic : public MPC_Derivatives {
+public:
+    MPC_Analytic(const MPCConfig& config);
+
+    virtual ~MPC_Analytic();
+
+    virtual void Structure(SizeVector& jac_row, SizeVector& jac_col,
+                           SizeVector& hes_row, SizeVector& hes_col);
+
+    virtual void SetParameters(const Dvector& params);
+
+    virtual double Cost(const double* x);
+    virtual void Gradient(const double* x, double* grad);
+    virtual void Constraints(const double* x, double* g);
+    virtual void Jacobian(const double* x, double* values);
+    virtual void Hessian(const double* x, double obj_factor, const double* lambda, double* values);
+
+private:
+    MPCConfig p;
+    std::vector<double> coeffs;  // of the fitted polynomial
+    double ref_v;
+
+    size_t x_start, y_start, psi_start, v_start, cte_start, epsi_start, delta_start, a_start;
+};
+
+#endif /* MPC_ANALYTIC_H */
@@ -0,0 +1,38 @@
+#ifndef MPC_DERIVATIVES_H
+#define MPC_DERIVATIVES_H
+
+#include <cppad/cppad.hpp>
+#include "MPCConfig.h"
+
+// Evaluates the cost, the constraints and their derivatives without the
+// CppAD tape. MPC_NLP uses one when it is given (see MPC_NLP::SetDerivatives).
+//
+// The Jacobian of the constraints and the lower triangle of the Hessian of
+// the Lagrangian are returned as triplets whose structure is fixed:
+// Structure is called once and the evaluations fill the values in the same
+// order.
+
+class MPC_Derivatives {
+public:
+    typedef CPPAD_TESTVECTOR(double) Dvector;
+    typedef CPPAD_TESTVECTOR(size_t) SizeVector;
+
+    virtual ~MPC_Derivatives() {}
+
+    // Rows and columns of the Jacobian and Hessian entries
+    virtual void Structure(SizeVector& jac_row, SizeVector& jac_col,
+                           SizeVector& hes_row, SizeVector& hes_col) = 0;
+
+    // Coefficients of the polynomial followed by the reference speed,
+    // same layout as the dynamic parameters of the tape (see MPCConfig)
+    virtual void SetParameters(const Dvector& params) = 0;
+
+    virtual double Cost(const double* x) = 0;
+    virtual void Gradient(const double* x, double* grad) = 0;
+    virtual void Constraints(const double* x, double* g) = 0;
+    virtual void Jacobian(const double* x, double* values) = 0;
+    virtual void Hessian(const double* x, double obj_factor, const double* lambda,
+                         double* values) = 0;
+};
+
+#endif /* MPC_DERIVATIVES_H */
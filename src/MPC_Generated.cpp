@@ -0,0 +1,271 @@
+#include "MPC_Generated.h"
+#include "MPC_Model.h"
+#include <cassert>
+
+// Largest number of kernel inputs or Jacobian entries of a cost kernel
+static const int max_in = 2 * Model::N_STATE + Model::N_ACTUATION;
+
+MPC_Generated::MPC_Generated(const MPCConfig& config) : p(config) {
+    x_start = p.x_start();
+    y_start = p.y_start();
+    psi_start = p.psi_start();
+    v_start = p.v_start();
+    cte_start = p.cte_start();
+    epsi_start = p.epsi_start();
+    delta_start = p.delta_start();
+    a_start = p.a_start();
+
+    for (int i = 0; i < KERNEL_N_PARAMS; i++) {
+        par[i] = 0.0;
+    }
+    par[KERNEL_DT] = p.dt;
+    par[KERNEL_LF] = p.Lf;
+    par[KERNEL_W_DELTA] = p.w_delta;
+    par[KERNEL_W_DDELTA] = p.w_ddelta;
+
+    assert(kernel_step.n_in <= max_in);
+    assert(kernel_state_cost.jac_nnz <= max_in);
+    assert(kernel_actuation_cost.jac_nnz <= max_in);
+    assert(kernel_actuation_change_cost.jac_nnz <= max_in);
+}
+
+MPC_Generated::~MPC_Generated() {}
+
+void MPC_Generated::StepInputs(size_t t, size_t* index) const {
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int i = 0; i < Model::N_STATE; i++) {
+        index[2 * i] = starts[i] + t;
+        index[2 * i + 1] = starts[i] + t + 1;
+    }
+    index[2 * Model::N_STATE] = delta_start + t;
+    index[2 * Model::N_STATE + 1] = a_start + t;
+}
+
+void MPC_Generated::StateInputs(size_t t, size_t* index) const {
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    for (int i = 0; i < Model::N_STATE; i++) {
+        index[i] = starts[i] + t;
+    }
+}
+
+void MPC_Generated::ActuationInputs(size_t t, size_t* index) const {
+    index[0] = delta_start + t;
+    index[1] = a_start + t;
+}
+
+void MPC_Generated::ActuationChangeInputs(size_t t, size_t* index) const {
+    index[0] = delta_start + t;
+    index[1] = delta_start + t + 1;
+    index[2] = a_start + t;
+    index[3] = a_start + t + 1;
+}
+
+void MPC_Generated::Gather(const double* x, const size_t* index, int n, double* in) {
+    for (int i = 0; i < n; i++) {
+        in[i] = x[index[i]];
+    }
+}
+
+// The Jacobian has the 6 initial rows followed by the step kernel of each
+// step. The Hessian has the step kernel of each step followed by the cost
+// kernels of the state, the actuations and the change of actuations.
+
+void MPC_Generated::Structure(SizeVector& jac_row, SizeVector& jac_col,
+                              SizeVector& hes_row, SizeVector& hes_col) {
+    assert(p.order == KERNEL_ORDER);
+    size_t N = p.N;
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    size_t index[max_in];
+
+    jac_row.resize(Model::N_STATE + kernel_step.jac_nnz * (N - 1));
+    jac_col.resize(jac_row.size());
+    size_t k = 0;
+    for (int i = 0; i < Model::N_STATE; i++) {
+        jac_row[k] = starts[i];
+        jac_col[k++] = starts[i];
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        StepInputs(t, index);
+        for (int i = 0; i < kernel_step.jac_nnz; i++) {
+            jac_row[k] = starts[kernel_step.jac_row[i]] + t + 1;
+            jac_col[k++] = index[kernel_step.jac_col[i]];
+        }
+    }
+
+    hes_row.resize(kernel_step.hes_nnz * (N - 1) + kernel_state_cost.hes_nnz * N +
+                   kernel_actuation_cost.hes_nnz * (N - 1) +
+                   kernel_actuation_change_cost.hes_nnz * (N - 2));
+    hes_col.resize(hes_row.size());
+    k = 0;
+    for (size_t t = 0; t < N - 1; t++) {
+        StepInputs(t, index);
+        for (int i = 0; i < kernel_step.hes_nnz; i++) {
+            hes_row[k] = index[kernel_step.hes_row[i]];
+            hes_col[k++] = index[kernel_step.hes_col[i]];
+        }
+    }
+    for (size_t t = 0; t < N; t++) {
+        StateInputs(t, index);
+        for (int i = 0; i < kernel_state_cost.hes_nnz; i++) {
+            hes_row[k] = index[kernel_state_cost.hes_row[i]];
+            hes_col[k++] = index[kernel_state_cost.hes_col[i]];
+        }
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        ActuationInputs(t, index);
+        for (int i = 0; i < kernel_actuation_cost.hes_nnz; i++) {
+            hes_row[k] = index[kernel_actuation_cost.hes_row[i]];
+            hes_col[k++] = index[kernel_actuation_cost.hes_col[i]];
+        }
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        ActuationChangeInputs(t, index);
+        for (int i = 0; i < kernel_actuation_change_cost.hes_nnz; i++) {
+            hes_row[k] = index[kernel_actuation_change_cost.hes_row[i]];
+            hes_col[k++] = index[kernel_actuation_change_cost.hes_col[i]];
+        }
+    }
+}
+
+void MPC_Generated::SetParameters(const Dvector& params) {
+    for (int i = 0; i <= KERNEL_ORDER; i++) {
+        par[KERNEL_COEFFS + i] = params[i];
+    }
+    par[KERNEL_REF_V] = params[KERNEL_ORDER + 1];
+}
+
+double MPC_Generated::Cost(const double* x) {
+    size_t N = p.N;
+    size_t index[max_in];
+    double in[max_in];
+    double out;
+    double cost = 0.0;
+    for (size_t t = 0; t < N; t++) {
+        StateInputs(t, index);
+        Gather(x, index, kernel_state_cost.n_in, in);
+        kernel_state_cost.eval(in, par, &out);
+        cost += out;
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        ActuationInputs(t, index);
+        Gather(x, index, kernel_actuation_cost.n_in, in);
+        kernel_actuation_cost.eval(in, par, &out);
+        cost += out;
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        ActuationChangeInputs(t, index);
+        Gather(x, index, kernel_actuation_change_cost.n_in, in);
+        kernel_actuation_change_cost.eval(in, par, &out);
+        cost += out;
+    }
+    return cost;
+}
+
+void MPC_Generated::Gradient(const double* x, double* grad) {
+    size_t N = p.N;
+    size_t index[max_in];
+    double in[max_in];
+    double d[max_in];
+    for (size_t i = 0; i < a_start + N - 1; i++) {
+        grad[i] = 0.0;
+    }
+    for (size_t t = 0; t < N; t++) {
+        StateInputs(t, index);
+        Gather(x, index, kernel_state_cost.n_in, in);
+        kernel_state_cost.jac(in, par, d);
+        for (int i = 0; i < kernel_state_cost.jac_nnz; i++) {
+            grad[index[kernel_state_cost.jac_col[i]]] += d[i];
+        }
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        ActuationInputs(t, index);
+        Gather(x, index, kernel_actuation_cost.n_in, in);
+        kernel_actuation_cost.jac(in, par, d);
+        for (int i = 0; i < kernel_actuation_cost.jac_nnz; i++) {
+            grad[index[kernel_actuation_cost.jac_col[i]]] += d[i];
+        }
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        ActuationChangeInputs(t, index);
+        Gather(x, index, kernel_actuation_change_cost.n_in, in);
+        kernel_actuation_change_cost.jac(in, par, d);
+        for (int i = 0; i < kernel_actuation_change_cost.jac_nnz; i++) {
+            grad[index[kernel_actuation_change_cost.jac_col[i]]] += d[i];
+        }
+    }
+}
+
+void MPC_Generated::Constraints(const double* x, double* g) {
+    size_t N = p.N;
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    size_t index[max_in];
+    double in[max_in];
+    double out[Model::N_STATE];
+    for (int i = 0; i < Model::N_STATE; i++) {
+        g[starts[i]] = x[starts[i]];
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        StepInputs(t, index);
+        Gather(x, index, kernel_step.n_in, in);
+        kernel_step.eval(in, par, out);
+        for (int i = 0; i < Model::N_STATE; i++) {
+            g[starts[i] + t + 1] = out[i];
+        }
+    }
+}
+
+void MPC_Generated::Jacobian(const double* x, double* values) {
+    size_t N = p.N;
+    size_t index[max_in];
+    double in[max_in];
+    for (int i = 0; i < Model::N_STATE; i++) {
+        values[i] = 1.0;
+    }
+    values += Model::N_STATE;
+    for (size_t t = 0; t < N - 1; t++) {
+        StepInputs(t, index);
+        Gather(x, index, kernel_step.n_in, in);
+        kernel_step.jac(in, par, values);
+        values += kernel_step.jac_nnz;
+    }
+}
+
+void MPC_Generated::Hessian(const double* x, double obj_factor, const double* lambda,
+                            double* values) {
+    size_t N = p.N;
+    size_t starts[] = {x_start, y_start, psi_start, v_start, cte_start, epsi_start};
+    size_t index[max_in];
+    double in[max_in];
+    double w[Model::N_STATE];
+
+    // Dynamics of step t, with the multipliers of the constraints at t + 1
+    for (size_t t = 0; t < N - 1; t++) {
+        StepInputs(t, index);
+        Gather(x, index, kernel_step.n_in, in);
+        for (int i = 0; i < Model::N_STATE; i++) {
+            w[i] = lambda[starts[i] + t + 1];
+        }
+        kernel_step.hes(in, par, w, values);
+        values += kernel_step.hes_nnz;
+    }
+
+    // Cost
+    for (size_t t = 0; t < N; t++) {
+        StateInputs(t, index);
+        Gather(x, index, kernel_state_cost.n_in, in);
+        kernel_state_cost.hes(in, par, &obj_factor, values);
+        values += kernel_state_cost.hes_nnz;
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+        ActuationInputs(t, index);
+        Gather(x, index, kernel_actuation_cost.n_in, in);
+        kernel_actuation_cost.hes(in, par, &obj_factor, values);
+        values += kernel_actuation_cost.hes_nnz;
+    }
+    for (size_t t = 0; t < N - 2; t++) {
+        ActuationChangeInputs(t, index);
+        Gather(x, index, kernel_actuation_change_cost.n_in, in);
+        kernel_actuation_change_cost.hes(in, par, &obj_factor, values);
+        values += kernel_actuation_change_cost.hes_nnz;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MPC_GENERATED_H
+#define MPC_GENERATED_H
+
+#include "MPC_Derivatives.h"
+#include "MPC_Kernel.h"
+
+// Derivatives from the code generated at build time (see MPC_Kernel.h).
+//
+// The kernels cover one step, this assembles them over the horizon. Entries
+// of different steps that fall on the same variables are left as separate
+// triplets, Ipopt adds them.
+
+class MPC_Generated : public MPC_Derivatives {
+public:
+    // Only for config.order == KERNEL_ORDER
+    MPC_Generated(const MPCConfig& config);
+
+    virtual ~MPC_Generated();
+
+    virtual void Structure(SizeVector& jac_row, SizeVector& jac_col,
+                           SizeVector& hes_row, SizeVector& hes_col);
+
+    virtual void SetParameters(const Dvector& params);
+
+    virtual double Cost(const double* x);
+    virtual void Gradient(const double* x, double* grad);
+    virtual void Constraints(const double* x, double* g);
+    virtual void Jacobian(const double* x, double* values);
+    virtual void Hessian(const double* x, double obj_factor, const double* lambda, double* values);
+
+private:
+    MPCConfig p;
+    double par[KERNEL_N_PARAMS];
+
+    size_t x_start, y_start, psi_start, v_start, cte_start, epsi_start, delta_start, a_start;
+
+    // Index in the problem of each kernel input, for step t
+    void StepInputs(size_t t, size_t* index) const;
+    void StateInputs(size_t t, size_t* index) const;
+    void ActuationInputs(size_t t, size_t* index) const;
+    void ActuationChangeInputs(size_t t, size_t* index) const;
+
+    // Kernel inputs gathered from x
+    static void Gather(const double* x, const size_t* index, int n, double* in);
+};
+
+#endif /* MPC_GENERATED_H */
@@ -0,0 +1,52 @@
+#ifndef MPC_KERNEL_H
+#define MPC_KERNEL_H
+
+// Straight-line code for the model of one step and its derivatives, written
+// at build time by src/codegen/mpc_codegen.cpp from MPC_Model.h.
+//
+// Each kernel maps `n_in` inputs to `n_out` outputs. The Jacobian is given
+// as (output, input) triplets and the Hessian of sum_i w[i] out[i] as the
+// (input, input) triplets of its lower triangle. `par` holds the parameters
+// below.
+
+// Order of the polynomial the kernels are generated for
+enum { KERNEL_ORDER = 3 };
+
+enum KernelParam {
+    KERNEL_COEFFS = 0,      // KERNEL_ORDER + 1 coefficients of the polynomial
+    KERNEL_REF_V = KERNEL_ORDER + 1,
+    KERNEL_DT,
+    KERNEL_LF,
+    KERNEL_W_DELTA,
+    KERNEL_W_DDELTA,
+    KERNEL_N_PARAMS
+};
+
+struct MPC_Kernel {
+    int n_in;
+    int n_out;
+    int jac_nnz;
+    const int* jac_row;
+    const int* jac_col;
+    int hes_nnz;
+    const int* hes_row;
+    const int* hes_col;
+    void (*eval)(const double* in, const double* par, double* out);
+    void (*jac)(const double* in, const double* par, double* values);
+    void (*hes)(const double* in, const double* par, const double* w, double* values);
+};
+
+// Residuals of Model::Step. Inputs are x0, x1, y0, y1, psi0, psi1, v0, v1,
+// cte0, cte1, epsi0, epsi1, delta0, a0.
+extern const MPC_Kernel kernel_step;
+
+// Model::StateCost. Inputs are x, y, psi, v, cte, epsi.
+extern const MPC_Kernel kernel_state_cost;
+
+// Model::ActuationCost. Inputs are delta, a.
+extern const MPC_Kernel kernel_actuation_cost;
+
+// Model::ActuationChangeCost. Inputs are delta0, delta1, a0, a1.
+extern const MPC_Kernel kernel_actuation_change_cost;
+
+#endif /* MPC_KERNEL_H */
@@ -0,0 +1,99 @@
+#ifndef MPC_MODEL_H
+#define MPC_MODEL_H
+
+#include <math.h>
+
+// The kinematic model and the cost of one step, written for any scalar type.
+// FG_eval evaluates them with AD<double> to record the tape and the code
+// generator in src/codegen with its symbolic type, so both see the same
+// model.
+//
+// Recall the equations for the model:
+// x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
+// y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
+// psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
+// v_[t+1] = v[t] + a[t] * dt
+// cte[t+1] = f(x[t+1]) - y[t+1]
+// epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
+
+struct Model {
+    enum State { X, Y, PSI, V, CTE, EPSI, N_STATE };
+    enum Actuation { DELTA, A, N_ACTUATION };
+
+    // Value of the fitted polynomial at x
+    template <class T, class C>
+    static T Poly(const C& coeffs, int order, const T& x) {
+        T f = coeffs[0];
+        T xi = x;
+        for (int i = 1; i <= order; i++) {
+            f += coeffs[i] * xi;
+            xi = xi * x;
+        }
+        return f;
+    }
+
+    // Value and first two derivatives at x of the polynomial of degree n
+    // with coefficients c, by Horner's rule.
+    static void PolyDerivatives(const double* c, int n, double x, double& f, double& df,
+                                double& d2f) {
+        f = c[n];
+        df = 0.0;
+        d2f = 0.0;
+        for (int i = n - 1; i >= 0; i--) {
+            d2f = d2f * x + 2 * df;
+            df = df * x + f;
+            f = f * x + c[i];
+        }
+    }
+
+    // Tangent of the desired heading at x. As tuned, it is the polynomial of
+    // the coefficients shifted one power down, c1 + c2 x + c3 x^2 for a cubic.
+    template <class T, class C>
+    static T HeadingSlope(const C& coeffs, int order, const T& x) {
+        T q = coeffs[1];
+        T xi = x;
+        for (int i = 2; i <= order; i++) {
+            q += coeffs[i] * xi;
+            xi = xi * x;
+        }
+        return q;
+    }
+
+    // Residuals g of the step from s0 with actuation u0 to s1. `coeffs` are
+    // the `order` + 1 coefficients of the fitted polynomial.
+    template <class T, class C, class D>
+    static void Step(const T* s0, const T* u0, const T* s1, const C& coeffs, int order,
+                     const D& dt, const D& Lf, T* g) {
+        T x01 = s0[X] + s0[V] * cos(s0[PSI]) * dt;
+        T f1 = Poly(coeffs, order, x01);
+        T psides0 = atan(HeadingSlope(coeffs, order, s0[X]));
+
+        g[X] = s1[X] - (s0[X] + s0[V] * cos(s0[PSI]) * dt);
+        g[Y] = s1[Y] - (s0[Y] + s0[V] * sin(s0[PSI]) * dt);
+        g[PSI] = s1[PSI] - (s0[PSI] + s0[V] * u0[DELTA] / Lf * dt);
+        g[V] = s1[V] - (s0[V] + u0[A] * dt);
+        g[CTE] = s1[CTE] - (f1 - (s0[Y] + s0[V] * sin(s0[PSI]) * dt));
+        g[EPSI] = s1[EPSI] - ((s0[PSI] - psides0) + s0[V] * u0[DELTA] / Lf * dt);
+    }
+
+    // Cost of the state at one step
+    template <class T, class R>
+    static T StateCost(const T* s, const R& ref_v) {
+        return s[CTE] * s[CTE] + s[EPSI] * s[EPSI] + (s[V] - ref_v) * (s[V] - ref_v);
+    }
+
+    // Cost of the use of the actuators
+    template <class T, class W>
+    static T ActuationCost(const T* u, const W& w_delta) {
+        return w_delta * u[DELTA] * u[DELTA] + u[A] * u[A];
+    }
+
+    // Cost of the change between sequential actuations
+    template <class T, class W>
+    static T ActuationChangeCost(const T* u0, const T* u1, const W& w_ddelta) {
+        return w_ddelta * (u1[DELTA] - u0[DELTA]) * (u1[DELTA] - u0[DELTA]) +
+            (u1[A] - u0[A]) * (u1[A] - u0[A]);
+    }
+};
+
+#endif /* MPC_MODEL_H */
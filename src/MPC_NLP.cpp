@@ -0,0 +1,521 @@
+#include "MPC_NLP.h"
+#include <coin/IpIpoptData.hpp>
+#include <cassert>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include "AllocationCounter.h"
+#include "Profile.h"
+
+using Ipopt::Index;
+using Ipopt::Number;
+
+MPC_NLP::MPC_NLP(CppAD::ipopt::solve_result<Dvector>& solution)
+    : iterations(0), eval_time(0), iteration_start(0), use_deadline(false), deadline_hit(false), warm_start(false), n_vars(0), n_constraints(0), solution(solution),
+      derivatives(NULL), fg_valid(false), jac_valid(false) {}
+
+MPC_NLP::~MPC_NLP() {}
+
+std::mutex MPC_NLP::mutex;
+
+bool MPC_NLP::ThreadSafe(const std::string& linear_solver) {
+    return linear_solver == "ma27" || linear_solver == "ma57" || linear_solver == "ma77" ||
+        linear_solver == "ma86" || linear_solver == "ma97";
+}
+
+static std::atomic<bool> parallel(false);
+static thread_local size_t thread_number = 0;
+
+static bool InParallel() {
+    return parallel.load(std::memory_order_relaxed);
+}
+
+static size_t ThreadNumber() {
+    return thread_number;
+}
+
+void MPC_NLP::Parallel(size_t n_threads) {
+    CppAD::thread_alloc::parallel_setup(n_threads, InParallel, ThreadNumber);
+    CppAD::thread_alloc::hold_memory(true);
+    CppAD::parallel_ad<double>();
+    parallel.store(true);
+}
+
+void MPC_NLP::Thread(size_t number) {
+    thread_number = number;
+}
+
+// Compute the sparsity patterns once for the recorded tape.
+
+void MPC_NLP::Setup(size_t n_vars, size_t n_constraints) {
+    this->n_vars = n_vars;
+    this->n_constraints = n_constraints;
+
+    size_t n = n_vars;
+    size_t m = n_constraints + 1;
+
+    vars.resize(n);
+    vars_lowerbound.resize(n);
+    vars_upperbound.resize(n);
+    constraints_lowerbound.resize(n_constraints);
+    constraints_upperbound.resize(n_constraints);
+    z_lower.resize(n);
+    z_upper.resize(n);
+    lambda.resize(n_constraints);
+    x_cur.resize(n);
+    fg_cur.resize(m);
+    w.resize(m);
+
+    // Sized now so storing a solution does not allocate from another thread
+    solution.x.resize(n);
+    solution.zl.resize(n);
+    solution.zu.resize(n);
+    solution.g.resize(n_constraints);
+    solution.lambda.resize(n_constraints);
+
+    // Jacobian of fg
+    CppAD::sparse_rc<SizeVector> identity(n, n, n);
+    for (size_t k = 0; k < n; k++) {
+        identity.set(k, k, k);
+    }
+    fun.for_jac_sparsity(identity, false, false, true, jac_pattern);
+    jac_subset = CppAD::sparse_rcv<SizeVector, Dvector>(jac_pattern);
+    jac_work.clear();
+
+    const SizeVector& jrow = jac_pattern.row();
+    size_t n_grad = 0;
+    for (size_t k = 0; k < jac_pattern.nnz(); k++) {
+        if (jrow[k] == 0) {
+            n_grad++;
+        }
+    }
+    grad_index.resize(n_grad);
+    jac_index.resize(jac_pattern.nnz() - n_grad);
+    size_t ig = 0, ij = 0;
+    for (size_t k = 0; k < jac_pattern.nnz(); k++) {
+        if (jrow[k] == 0) {
+            grad_index[ig++] = k;
+        } else {
+            jac_index[ij++] = k;
+        }
+    }
+
+    // Hessian of the Lagrangian. sparse_hes needs the full symmetric
+    // pattern, Ipopt only wants the lower triangle.
+    CPPAD_TESTVECTOR(bool) select_domain(n);
+    CPPAD_TESTVECTOR(bool) select_range(m);
+    for (size_t j = 0; j < n; j++) {
+        select_domain[j] = true;
+    }
+    for (size_t i = 0; i < m; i++) {
+        select_range[i] = true;
+    }
+    fun.for_hes_sparsity(select_domain, select_range, true, hes_pattern);
+
+    const SizeVector& hrow = hes_pattern.row();
+    const SizeVector& hcol = hes_pattern.col();
+    size_t n_lower = 0;
+    for (size_t k = 0; k < hes_pattern.nnz(); k++) {
+        if (hrow[k] >= hcol[k]) {
+            n_lower++;
+        }
+    }
+    CppAD::sparse_rc<SizeVector> lower(n, n, n_lower);
+    size_t il = 0;
+    for (size_t k = 0; k < hes_pattern.nnz(); k++) {
+        if (hrow[k] >= hcol[k]) {
+            lower.set(il++, hrow[k], hcol[k]);
+        }
+    }
+    hes_subset = CppAD::sparse_rcv<SizeVector, Dvector>(lower);
+    hes_work.clear();
+
+    fg_valid = false;
+    jac_valid = false;
+}
+
+void MPC_NLP::SetParameters(const Dvector& params) {
+    if (derivatives != NULL) {
+        derivatives->SetParameters(params);
+    } else {
+        fun.new_dynamic(params);
+    }
+    fg_valid = false;
+    jac_valid = false;
+}
+
+void MPC_NLP::SetDerivatives(MPC_Derivatives* derivatives) {
+    this->derivatives = derivatives;
+    if (derivatives != NULL) {
+        derivatives->Structure(jac_row, jac_col, hes_row, hes_col);
+    }
+    fg_valid = false;
+    jac_valid = false;
+}
+
+double MPC_NLP::CheckDerivatives(MPC_Derivatives& provider, const Dvector& params,
+                                 const Dvector& x, double obj_factor, const Dvector& lambda) {
+    size_t n = n_vars;
+    size_t m = n_constraints;
+
+    fun.new_dynamic(params);
+    provider.SetParameters(params);
+    for (size_t j = 0; j < n; j++) {
+        x_cur[j] = x[j];
+    }
+    fg_valid = false;
+    jac_valid = false;
+    EvalFG();
+    EvalJac();
+    w[0] = obj_factor;
+    for (size_t i = 0; i < m; i++) {
+        w[1 + i] = lambda[i];
+    }
+    fun.sparse_hes(x_cur, w, hes_subset, hes_pattern, "cppad.symmetric", hes_work);
+
+    // Dense copies of both, the gradient being row 0 of the Jacobian
+    Dvector fg(1 + m);
+    Dvector jac_tape(n * (1 + m));
+    Dvector jac_provider(n * (1 + m));
+    Dvector hes_tape(n * n);
+    Dvector hes_provider(n * n);
+    for (size_t k = 0; k < jac_tape.size(); k++) {
+        jac_tape[k] = 0.0;
+        jac_provider[k] = 0.0;
+    }
+    for (size_t k = 0; k < hes_tape.size(); k++) {
+        hes_tape[k] = 0.0;
+        hes_provider[k] = 0.0;
+    }
+
+    const SizeVector& row = jac_subset.row();
+    const SizeVector& col = jac_subset.col();
+    const Dvector& val = jac_subset.val();
+    for (size_t k = 0; k < jac_subset.nnz(); k++) {
+        jac_tape[row[k] * n + col[k]] += val[k];
+    }
+    const SizeVector& hrow = hes_subset.row();
+    const SizeVector& hcol = hes_subset.col();
+    const Dvector& hval = hes_subset.val();
+    for (size_t k = 0; k < hes_subset.nnz(); k++) {
+        hes_tape[hrow[k] * n + hcol[k]] += hval[k];
+    }
+
+    SizeVector prow, pcol, phrow, phcol;
+    provider.Structure(prow, pcol, phrow, phcol);
+    fg[0] = provider.Cost(x_cur.data());
+    provider.Constraints(x_cur.data(), fg.data() + 1);
+    provider.Gradient(x_cur.data(), jac_provider.data());
+    Dvector values(prow.size());
+    provider.Jacobian(x_cur.data(), values.data());
+    for (size_t k = 0; k < prow.size(); k++) {
+        jac_provider[(1 + prow[k]) * n + pcol[k]] += values[k];
+    }
+    values.resize(phrow.size());
+    provider.Hessian(x_cur.data(), obj_factor, lambda.data(), values.data());
+    for (size_t k = 0; k < phrow.size(); k++) {
+        hes_provider[phrow[k] * n + phcol[k]] += values[k];
+    }
+
+    double err = 0.0;
+    for (size_t i = 0; i < fg.size(); i++) {
+        err = std::max(err, fabs(fg[i] - fg_cur[i]));
+    }
+    for (size_t k = 0; k < jac_tape.size(); k++) {
+        err = std::max(err, fabs(jac_provider[k] - jac_tape[k]));
+    }
+    for (size_t k = 0; k < hes_tape.size(); k++) {
+        err = std::max(err, fabs(hes_provider[k] - hes_tape[k]));
+    }
+
+    fg_valid = false;
+    jac_valid = false;
+    return err;
+}
+
+void MPC_NLP::NewPoint(const Number* x, bool new_x) {
+    if (new_x) {
+        for (size_t i = 0; i < n_vars; i++) {
+            x_cur[i] = x[i];
+        }
+        fg_valid = false;
+        jac_valid = false;
+    }
+}
+
+void MPC_NLP::EvalFG() {
+    if (!fg_valid) {
+        fg_cur = fun.Forward(0, x_cur);
+        fg_valid = true;
+    }
+}
+
+void MPC_NLP::EvalJac() {
+    if (!jac_valid) {
+        fun.sparse_jac_rev(x_cur, jac_subset, jac_pattern, "cppad", jac_work);
+        jac_valid = true;
+    }
+}
+
+bool MPC_NLP::get_nlp_info(Index& n, Index& m, Index& nnz_jac_g, Index& nnz_h_lag,
+                           IndexStyleEnum& index_style) {
+    AllocationCounter::Resume resume;
+    n = n_vars;
+    m = n_constraints;
+    if (derivatives != NULL) {
+        nnz_jac_g = jac_row.size();
+        nnz_h_lag = hes_row.size();
+    } else {
+        nnz_jac_g = jac_index.size();
+        nnz_h_lag = hes_subset.nnz();
+    }
+    index_style = C_STYLE;
+    return true;
+}
+
+bool MPC_NLP::get_bounds_info(Index n, Number* x_l, Number* x_u, Index m, Number* g_l,
+                              Number* g_u) {
+    AllocationCounter::Resume resume;
+    assert(size_t(n) == n_vars && size_t(m) == n_constraints);
+    for (Index i = 0; i < n; i++) {
+        x_l[i] = vars_lowerbound[i];
+        x_u[i] = vars_upperbound[i];
+    }
+    for (Index i = 0; i < m; i++) {
+        g_l[i] = constraints_lowerbound[i];
+        g_u[i] = constraints_upperbound[i];
+    }
+    return true;
+}
+
+bool MPC_NLP::get_starting_point(Index n, bool init_x, Number* x, bool init_z, Number* z_L,
+                                 Number* z_U, Index m, bool init_lambda, Number* lambda) {
+    AllocationCounter::Resume resume;
+    assert(init_x);
+    assert(warm_start || (!init_z && !init_lambda));
+    for (Index i = 0; i < n; i++) {
+        x[i] = vars[i];
+    }
+    if (init_z) {
+        for (Index i = 0; i < n; i++) {
+            z_L[i] = z_lower[i];
+            z_U[i] = z_upper[i];
+        }
+    }
+    if (init_lambda) {
+        for (Index i = 0; i < m; i++) {
+            lambda[i] = this->lambda[i];
+        }
+    }
+    return true;
+}
+
+bool MPC_NLP::eval_f(Index n, const Number* x, bool new_x, Number& obj_value) {
+    AllocationCounter::Resume resume;
+    Profile::Watch watch(eval_time, eval_counters, "eval_f");
+    if (derivatives != NULL) {
+        obj_value = derivatives->Cost(x);
+        return true;
+    }
+    NewPoint(x, new_x);
+    EvalFG();
+    obj_value = fg_cur[0];
+    return true;
+}
+
+bool MPC_NLP::eval_grad_f(Index n, const Number* x, bool new_x, Number* grad_f) {
+    AllocationCounter::Resume resume;
+    Profile::Watch watch(eval_time, eval_counters, "eval_grad_f");
+    if (derivatives != NULL) {
+        derivatives->Gradient(x, grad_f);
+        return true;
+    }
+    NewPoint(x, new_x);
+    EvalJac();
+    for (Index j = 0; j < n; j++) {
+        grad_f[j] = 0.0;
+    }
+    const SizeVector& col = jac_subset.col();
+    const Dvector& val = jac_subset.val();
+    for (size_t k = 0; k < grad_index.size(); k++) {
+        grad_f[col[grad_index[k]]] = val[grad_index[k]];
+    }
+    return true;
+}
+
+bool MPC_NLP::eval_g(Index n, const Number* x, bool new_x, Index m, Number* g) {
+    AllocationCounter::Resume resume;
+    Profile::Watch watch(eval_time, eval_counters, "eval_g");
+    if (derivatives != NULL) {
+        derivatives->Constraints(x, g);
+        return true;
+    }
+    NewPoint(x, new_x);
+    EvalFG();
+    for (Index i = 0; i < m; i++) {
+        g[i] = fg_cur[1 + i];
+    }
+    return true;
+}
+
+bool MPC_NLP::eval_jac_g(Index n, const Number* x, bool new_x, Index m, Index nele_jac,
+                         Index* iRow, Index* jCol, Number* values) {
+    AllocationCounter::Resume resume;
+    Profile::Watch watch(eval_time, eval_counters, "eval_jac_g");
+    if (derivatives != NULL) {
+        if (values == NULL) {
+            for (size_t k = 0; k < jac_row.size(); k++) {
+                iRow[k] = jac_row[k];
+                jCol[k] = jac_col[k];
+            }
+        } else {
+            derivatives->Jacobian(x, values);
+        }
+        return true;
+    }
+
+    const SizeVector& row = jac_subset.row();
+    const SizeVector& col = jac_subset.col();
+
+    if (values == NULL) {
+        for (size_t k = 0; k < jac_index.size(); k++) {
+            iRow[k] = row[jac_index[k]] - 1;
+            jCol[k] = col[jac_index[k]];
+        }
+        return true;
+    }
+
+    NewPoint(x, new_x);
+    EvalJac();
+    const Dvector& val = jac_subset.val();
+    for (size_t k = 0; k < jac_index.size(); k++) {
+        values[k] = val[jac_index[k]];
+    }
+    return true;
+}
+
+bool MPC_NLP::eval_h(Index n, const Number* x, bool new_x, Number obj_factor, Index m,
+                     const Number* lambda, bool new_lambda, Index nele_hess, Index* iRow,
+                     Index* jCol, Number* values) {
+    AllocationCounter::Resume resume;
+    Profile::Watch watch(eval_time, eval_counters, "eval_h");
+    if (derivatives != NULL) {
+        if (values == NULL) {
+            for (size_t k = 0; k < hes_row.size(); k++) {
+                iRow[k] = hes_row[k];
+                jCol[k] = hes_col[k];
+            }
+        } else {
+            derivatives->Hessian(x, obj_factor, lambda, values);
+        }
+        return true;
+    }
+
+    if (values == NULL) {
+        const SizeVector& row = hes_subset.row();
+        const SizeVector& col = hes_subset.col();
+        for (size_t k = 0; k < hes_subset.nnz(); k++) {
+            iRow[k] = row[k];
+            jCol[k] = col[k];
+        }
+        return true;
+    }
+
+    NewPoint(x, new_x);
+    w[0] = obj_factor;
+    for (Index i = 0; i < m; i++) {
+        w[1 + i] = lambda[i];
+    }
+    fun.sparse_hes(x_cur, w, hes_subset, hes_pattern, "cppad.symmetric", hes_work);
+
+    const Dvector& val = hes_subset.val();
+    for (size_t k = 0; k < hes_subset.nnz(); k++) {
+        values[k] = val[k];
+    }
+    return true;
+}
+
+bool MPC_NLP::intermediate_callback(Ipopt::AlgorithmMode mode, Index iter, Number obj_value,
+                                    Number inf_pr, Number inf_du, Number mu, Number d_norm,
+                                    Number regularization_size, Number alpha_du, Number alpha_pr,
+                                    Index ls_trials, const Ipopt::IpoptData* ip_data,
+                                    Ipopt::IpoptCalculatedQuantities* ip_cq) {
+    AllocationCounter::Resume resume;
+    if (Trace::Enabled()) {
+        uint64_t now = Profile::Now();
+        Trace::Complete("iteration", iteration_start, now);
+        iteration_start = now;
+    }
+    if (use_deadline && Clock::now() >= deadline) {
+        deadline_hit = true;
+        return false;
+    }
+    return true;
+}
+
+void MPC_NLP::finalize_solution(Ipopt::SolverReturn status, Index n, const Number* x,
+                                const Number* z_L, const Number* z_U, Index m, const Number* g,
+                                const Number* lambda, Number obj_value,
+                                const Ipopt::IpoptData* ip_data,
+                                Ipopt::IpoptCalculatedQuantities* ip_cq) {
+    AllocationCounter::Resume resume;
+    typedef CppAD::ipopt::solve_result<Dvector> result;
+
+    solution.x.resize(n);
+    solution.zl.resize(n);
+    solution.zu.resize(n);
+    for (Index j = 0; j < n; j++) {
+        solution.x[j] = x[j];
+        solution.zl[j] = z_L[j];
+        solution.zu[j] = z_U[j];
+    }
+    solution.g.resize(m);
+    solution.lambda.resize(m);
+    for (Index i = 0; i < m; i++) {
+        solution.g[i] = g[i];
+        solution.lambda[i] = lambda[i];
+    }
+    solution.obj_value = obj_value;
+    iterations = ip_data != NULL ? ip_data->iter_count() : 0;
+
+    switch (status) {
+        case Ipopt::SUCCESS:
+            solution.status = result::success;
+            break;
+        case Ipopt::MAXITER_EXCEEDED:
+            solution.status = result::maxiter_exceeded;
+            break;
+        case Ipopt::STOP_AT_TINY_STEP:
+            solution.status = result::stop_at_tiny_step;
+            break;
+        case Ipopt::STOP_AT_ACCEPTABLE_POINT:
+            solution.status = result::stop_at_acceptable_point;
+            break;
+        case Ipopt::LOCAL_INFEASIBILITY:
+            solution.status = result::local_infeasibility;
+            break;
+        case Ipopt::USER_REQUESTED_STOP:
+            solution.status = result::user_requested_stop;
+            break;
+        case Ipopt::FEASIBLE_POINT_FOUND:
+            solution.status = result::feasible_point_found;
+            break;
+        case Ipopt::DIVERGING_ITERATES:
+            solution.status = result::diverging_iterates;
+            break;
+        case Ipopt::RESTORATION_FAILURE:
+            solution.status = result::restoration_failure;
+            break;
+        case Ipopt::ERROR_IN_STEP_COMPUTATION:
+            solution.status = result::error_in_step_computation;
+            break;
+        case Ipopt::INVALID_NUMBER_DETECTED:
+            solution.status = result::invalid_number_detected;
+            break;
+        case Ipopt::INTERNAL_ERROR:
+            solution.status = result::internal_error;
+            break;
+        default:
+            solution.status = result::unknown;
+    }
+}
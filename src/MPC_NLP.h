@@ -0,0 +1,208 @@
+#ifndef MPC_NLP_H
+#define MPC_NLP_H
+
+#include <stdint.h>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <cppad/cppad.hpp>
+#include <cppad/ipopt/solve.hpp>
+#include "MPC_Derivatives.h"
+#include "PerfCounters.h"
+
+using CppAD::AD;
+
+// Ipopt problem built on a CppAD tape that is recorded only once.
+//
+// The polynomial coefficients and the reference speed are recorded as
+// dynamic parameters so each control tick only has to call SetParameters
+// and refill the bounds; the tape and the sparsity patterns are reused.
+//
+// When SetDerivatives is given a provider, the cost, the constraints and
+// their derivatives come from it instead of the tape.
+
+class MPC_NLP : public Ipopt::TNLP {
+public:
+    typedef CPPAD_TESTVECTOR(double) Dvector;
+    typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+    typedef CPPAD_TESTVECTOR(size_t) SizeVector;
+
+    // Initial point and bounds, filled by the caller before each solve
+    Dvector vars;
+    Dvector vars_lowerbound;
+    Dvector vars_upperbound;
+    Dvector constraints_lowerbound;
+    Dvector constraints_upperbound;
+
+    // Ipopt iterations of the last solve
+    int iterations;
+
+    // Nanoseconds, and hardware counters, spent in the eval_* callbacks,
+    // added to by every call
+    uint64_t eval_time;
+    PerfCounters::Values eval_counters;
+
+    // Profile::Now at the start of the current iteration, for the trace
+    uint64_t iteration_start;
+
+    // When use_deadline is set, the solve stops at the first iteration
+    // that ends after `deadline` and deadline_hit is set.
+    typedef std::chrono::steady_clock Clock;
+    bool use_deadline;
+    Clock::time_point deadline;
+    bool deadline_hit;
+
+    // Initial multipliers, used when warm_start is set
+    bool warm_start;
+    Dvector z_lower;
+    Dvector z_upper;
+    Dvector lambda;
+
+    MPC_NLP(CppAD::ipopt::solve_result<Dvector>& solution);
+
+    // The MUMPS linear solver of Ipopt has global state, so one thread at a
+    // time may run Ipopt with it: MPC::Solve holds this around those
+    // solves and MPC frees its Ipopt under it. The HSL solvers (see
+    // ThreadSafe) and the RTI run without it.
+    static std::mutex mutex;
+
+    // Whether Ipopt may run with `linear_solver` on several threads at once
+    static bool ThreadSafe(const std::string& linear_solver);
+
+    // Switch CppAD to a memory pool per thread for `n_threads` threads:
+    // the calling one, numbered 0, and the ones that call Thread. Call it
+    // once, before those threads use CppAD. Memory a thread took from its
+    // pool has to be given back by the same thread from then on, so a
+    // controller has to be built, solved and freed on one thread.
+    static void Parallel(size_t n_threads);
+
+    // Number the calling thread for CppAD, in [1, n_threads)
+    static void Thread(size_t number);
+
+    // Most threads Parallel takes
+    static const size_t MAX_THREADS = CPPAD_MAX_NUM_THREADS;
+
+    virtual ~MPC_NLP();
+
+    // Records fg_eval(fg, vars) once. `fg_eval` is built from `data` and
+    // must be built on the dynamic parameter vector it is given (see
+    // MPC.cpp).
+
+    template <class FG_eval, class Data>
+    void Record(const Data& data, size_t n_vars, size_t n_constraints, size_t n_params) {
+        ADvector avars(n_vars);
+        ADvector aparams(n_params);
+        ADvector afg(1 + n_constraints);
+        for (size_t i = 0; i < n_vars; i++) {
+            avars[i] = 0.0;
+        }
+        for (size_t i = 0; i < n_params; i++) {
+            aparams[i] = 0.0;
+        }
+
+        CppAD::Independent(avars, 0, false, aparams);
+        FG_eval fg_eval(data, aparams);
+        fg_eval(afg, avars);
+        fun.Dependent(avars, afg);
+        fun.optimize();
+
+        Setup(n_vars, n_constraints);
+    }
+
+    // Update the dynamic parameters (coefficients and reference speed)
+    void SetParameters(const Dvector& params);
+
+    // Evaluate with `derivatives` instead of the tape, or with the tape
+    // again if it is NULL. Must not be called during a solve.
+    void SetDerivatives(MPC_Derivatives* derivatives);
+
+    // Largest absolute difference between the tape and `provider` over the
+    // cost, the constraints, the gradient, the Jacobian and the Hessian of
+    // the Lagrangian at `x`.
+    double CheckDerivatives(MPC_Derivatives& provider, const Dvector& params, const Dvector& x,
+                            double obj_factor, const Dvector& lambda);
+
+    // Ipopt interface. Their allocations are counted by AllocationCounter,
+    // unlike those of Ipopt around them.
+    virtual bool get_nlp_info(Ipopt::Index& n, Ipopt::Index& m, Ipopt::Index& nnz_jac_g,
+                              Ipopt::Index& nnz_h_lag, IndexStyleEnum& index_style);
+
+    virtual bool get_bounds_info(Ipopt::Index n, Ipopt::Number* x_l, Ipopt::Number* x_u,
+                                 Ipopt::Index m, Ipopt::Number* g_l, Ipopt::Number* g_u);
+
+    virtual bool get_starting_point(Ipopt::Index n, bool init_x, Ipopt::Number* x,
+                                    bool init_z, Ipopt::Number* z_L, Ipopt::Number* z_U,
+                                    Ipopt::Index m, bool init_lambda, Ipopt::Number* lambda);
+
+    virtual bool eval_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x, Ipopt::Number& obj_value);
+
+    virtual bool eval_grad_f(Ipopt::Index n, const Ipopt::Number* x, bool new_x, Ipopt::Number* grad_f);
+
+    virtual bool eval_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x, Ipopt::Index m, Ipopt::Number* g);
+
+    virtual bool eval_jac_g(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                            Ipopt::Index m, Ipopt::Index nele_jac, Ipopt::Index* iRow,
+                            Ipopt::Index* jCol, Ipopt::Number* values);
+
+    virtual bool eval_h(Ipopt::Index n, const Ipopt::Number* x, bool new_x,
+                        Ipopt::Number obj_factor, Ipopt::Index m, const Ipopt::Number* lambda,
+                        bool new_lambda, Ipopt::Index nele_hess, Ipopt::Index* iRow,
+                        Ipopt::Index* jCol, Ipopt::Number* values);
+
+    virtual void finalize_solution(Ipopt::SolverReturn status, Ipopt::Index n, const Ipopt::Number* x,
+                                   const Ipopt::Number* z_L, const Ipopt::Number* z_U,
+                                   Ipopt::Index m, const Ipopt::Number* g, const Ipopt::Number* lambda,
+                                   Ipopt::Number obj_value, const Ipopt::IpoptData* ip_data,
+                                   Ipopt::IpoptCalculatedQuantities* ip_cq);
+
+    virtual bool intermediate_callback(Ipopt::AlgorithmMode mode, Ipopt::Index iter,
+                                       Ipopt::Number obj_value, Ipopt::Number inf_pr,
+                                       Ipopt::Number inf_du, Ipopt::Number mu, Ipopt::Number d_norm,
+                                       Ipopt::Number regularization_size, Ipopt::Number alpha_du,
+                                       Ipopt::Number alpha_pr, Ipopt::Index ls_trials,
+                                       const Ipopt::IpoptData* ip_data,
+                                       Ipopt::IpoptCalculatedQuantities* ip_cq);
+
+private:
+    size_t n_vars;
+    size_t n_constraints;
+
+    // The taped cost and constraints
+    CppAD::ADFun<double> fun;
+
+    // Where the results are stored
+    CppAD::ipopt::solve_result<Dvector>& solution;
+
+    // Jacobian of fg. Row 0 is the gradient of the cost.
+    CppAD::sparse_rc<SizeVector> jac_pattern;
+    CppAD::sparse_rcv<SizeVector, Dvector> jac_subset;
+    CppAD::sparse_jac_work jac_work;
+    SizeVector grad_index;  // entries of jac_subset in row 0
+    SizeVector jac_index;   // entries of jac_subset in rows 1..m
+
+    // Hessian of the Lagrangian, lower triangle
+    CppAD::sparse_rc<SizeVector> hes_pattern;
+    CppAD::sparse_rcv<SizeVector, Dvector> hes_subset;
+    CppAD::sparse_hes_work hes_work;
+
+    // Provider used instead of the tape, and its structure
+    MPC_Derivatives* derivatives;
+    SizeVector jac_row;
+    SizeVector jac_col;
+    SizeVector hes_row;
+    SizeVector hes_col;
+
+    // Cached evaluations at the current point
+    Dvector x_cur;
+    Dvector fg_cur;
+    Dvector w;
+    bool fg_valid;
+    bool jac_valid;
+
+    void Setup(size_t n_vars, size_t n_constraints);
+    void NewPoint(const Ipopt::Number* x, bool new_x);
+    void EvalFG();
+    void EvalJac();
+};
+
+#endif /* MPC_NLP_H */
@@ -0,0 +1,434 @@
+#include "MPC_RTI.h"
+#include "MPC_Model.h"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include <math.h>
+#include <algorithm>
+
+MPC_RTI::MPC_RTI(const MPCConfig& config, const Options& options)
+    : prepared(false), qp_iterations(0), p(config), options(options) {
+    size_t N = p.N;
+    nu = 2 * (N - 1);
+
+    x_start = p.x_start();
+    y_start = p.y_start();
+    psi_start = p.psi_start();
+    v_start = p.v_start();
+    cte_start = p.cte_start();
+    epsi_start = p.epsi_start();
+    delta_start = p.delta_start();
+    a_start = p.a_start();
+
+    vars.resize(p.n_vars());
+    for (size_t i = 0; i < vars.size(); i++) {
+        vars[i] = 0.0;
+    }
+
+    A.resize(4, 4 * (N - 1));
+    B.resize(4, nu);
+    d.resize(4, N - 1);
+    z0.resize(8);
+    u.resize(nu);
+    du.resize(nu);
+    lb.resize(nu);
+    ub.resize(nu);
+
+    // Both KKT modes are allocated so SetKKT can switch between them
+    Phi.resize(4 * N, 4);
+    Gam.resize(4 * N, nu);
+    e.resize(4 * N);
+    J.resize(3 * N, nu);
+    rho.resize(3 * N);
+    H.resize(nu, nu);
+    g.resize(nu);
+    K.resize(nu, nu);
+
+    // Actuation cost. Actuations are ordered delta0, a0, delta1, a1...
+    R.setZero(nu, nu);
+    for (size_t k = 0; k < N - 1; k++) {
+        R(2 * k, 2 * k) += p.w_delta;
+        R(2 * k + 1, 2 * k + 1) += 1.0;
+    }
+    for (size_t k = 0; k + 2 < N; k++) {
+        size_t i = 2 * k;
+        R(i, i) += p.w_ddelta;
+        R(i + 2, i + 2) += p.w_ddelta;
+        R(i, i + 2) -= p.w_ddelta;
+        R(i + 2, i) -= p.w_ddelta;
+        R(i + 1, i + 1) += 1.0;
+        R(i + 3, i + 3) += 1.0;
+        R(i + 1, i + 3) -= 1.0;
+        R(i + 3, i + 1) -= 1.0;
+    }
+
+    lq.Resize(N);
+    q.resize(8 * N);
+    r.resize(nu);
+    c.resize(8 * (N - 1));
+    z.resize(8 * N);
+    zero_q.setZero(8 * N);
+    zero_c.setZero(8 * (N - 1));
+    r_step.resize(nu);
+
+    // Box QP work
+    ll.resize(nu);
+    lu.resize(nu);
+    sl.resize(nu);
+    su.resize(nu);
+    grad.resize(nu);
+    rhs.resize(nu);
+    sig.resize(nu);
+    dx.resize(nu);
+    dll.resize(nu);
+    dlu.resize(nu);
+}
+
+void MPC_RTI::SetKKT(KKT kkt) {
+    options.kkt = kkt;
+    prepared = false;
+}
+
+MPC_RTI::~MPC_RTI() {}
+
+void MPC_RTI::Prepare() {
+    size_t N = p.N;
+    double dt = p.dt;
+
+    for (size_t k = 0; k < N - 1; k++) {
+        vars[delta_start + k] = std::max(-p.delta_max, std::min(p.delta_max, vars[delta_start + k]));
+        vars[a_start + k] = std::max(-p.a_max, std::min(p.a_max, vars[a_start + k]));
+        u(2 * k) = vars[delta_start + k];
+        u(2 * k + 1) = vars[a_start + k];
+        lb(2 * k) = -p.delta_max - u(2 * k);
+        ub(2 * k) = p.delta_max - u(2 * k);
+        lb(2 * k + 1) = -p.a_max - u(2 * k + 1);
+        ub(2 * k + 1) = p.a_max - u(2 * k + 1);
+    }
+
+    // Linearize x, y, psi and v. They do not depend on cte or epsi.
+    A.setZero();
+    B.setZero();
+    for (size_t t = 0; t < N - 1; t++) {
+        double x0 = vars[x_start + t];
+        double y0 = vars[y_start + t];
+        double psi0 = vars[psi_start + t];
+        double v0 = vars[v_start + t];
+        double delta0 = vars[delta_start + t];
+        double a0 = vars[a_start + t];
+        double c = cos(psi0);
+        double s = sin(psi0);
+
+        A(0, 4 * t + 0) = 1.0;
+        A(0, 4 * t + 2) = -v0 * s * dt;
+        A(0, 4 * t + 3) = c * dt;
+        A(1, 4 * t + 1) = 1.0;
+        A(1, 4 * t + 2) = v0 * c * dt;
+        A(1, 4 * t + 3) = s * dt;
+        A(2, 4 * t + 2) = 1.0;
+        A(2, 4 * t + 3) = delta0 / p.Lf * dt;
+        A(3, 4 * t + 3) = 1.0;
+
+        B(2, 2 * t) = v0 / p.Lf * dt;
+        B(3, 2 * t + 1) = dt;
+
+        d(0, t) = x0 + v0 * c * dt - vars[x_start + t + 1];
+        d(1, t) = y0 + v0 * s * dt - vars[y_start + t + 1];
+        d(2, t) = psi0 + v0 * delta0 / p.Lf * dt - vars[psi_start + t + 1];
+        d(3, t) = v0 + a0 * dt - vars[v_start + t + 1];
+    }
+
+    if (options.kkt == CONDENSED) {
+        Phi.topRows<4>().setIdentity();
+        Gam.topRows<4>().setZero();
+        e.head<4>().setZero();
+        for (size_t t = 0; t < N - 1; t++) {
+            const Eigen::Matrix4d At = A.block<4, 4>(0, 4 * t);
+            Phi.block<4, 4>(4 * (t + 1), 0) = At * Phi.block<4, 4>(4 * t, 0);
+            Gam.middleRows<4>(4 * (t + 1)).noalias() = At * Gam.middleRows<4>(4 * t);
+            Gam.block<4, 2>(4 * (t + 1), 2 * t) += B.block<4, 2>(0, 2 * t);
+            e.segment<4>(4 * (t + 1)) = At * e.segment<4>(4 * t) + d.col(t);
+        }
+    }
+
+    prepared = true;
+}
+
+// cte and epsi at step k + 1, and their derivatives with respect to
+// x, y, psi and v at step k. Only epsi depends on the actuations, through
+// delta with v * dt / Lf.
+
+void MPC_RTI::Outputs(size_t k, const VectorRef& coeffs, double& hc, Eigen::RowVector4d& Cc,
+                      double& he, Eigen::RowVector4d& Ce) {
+    double dt = p.dt;
+    double x0 = vars[x_start + k];
+    double y0 = vars[y_start + k];
+    double psi0 = vars[psi_start + k];
+    double v0 = vars[v_start + k];
+    double delta0 = vars[delta_start + k];
+    double c = cos(psi0);
+    double s = sin(psi0);
+
+    double x01 = x0 + v0 * c * dt;
+    double f1, df1, d2f1;
+    Model::PolyDerivatives(coeffs.data(), p.order, x01, f1, df1, d2f1);
+    hc = f1 - (y0 + v0 * s * dt);
+    Cc << df1, -1.0, -df1 * v0 * s * dt - v0 * c * dt, df1 * c * dt - s * dt;
+
+    double q, dq, d2q;
+    Model::PolyDerivatives(coeffs.data() + 1, p.order - 1, x0, q, dq, d2q);
+    he = psi0 - atan(q) + v0 * delta0 / p.Lf * dt;
+    Ce << -dq / (1 + q * q), 0.0, 1.0, delta0 / p.Lf * dt;
+}
+
+// Condensed QP: the cost is |rho + J du|^2 + (u + du)' R (u + du)
+
+void MPC_RTI::SetupCondensed(const VectorRef& state, const VectorRef& coeffs, double ref_v) {
+    size_t N = p.N;
+    const Eigen::Vector4d dp0 = z0.head<4>();
+
+    // Residuals of the state cost, 3 per step: v - ref_v, cte and epsi.
+    // Step 0 is fixed by the initial state.
+    J.setZero();
+    rho(0) = state[3] - ref_v;
+    rho(1) = state[4];
+    rho(2) = state[5];
+
+    for (size_t t = 1; t < N; t++) {
+        Eigen::Vector4d ct = Phi.block<4, 4>(4 * t, 0) * dp0 + e.segment<4>(4 * t);
+        rho(3 * t) = vars[v_start + t] + ct(3) - ref_v;
+        J.row(3 * t) = Gam.row(4 * t + 3);
+
+        // cte and epsi at t only depend on step t - 1
+        size_t k = t - 1;
+        double hc, he;
+        Eigen::RowVector4d Cc, Ce;
+        Outputs(k, coeffs, hc, Cc, he, Ce);
+
+        Eigen::Vector4d ck = Phi.block<4, 4>(4 * k, 0) * dp0 + e.segment<4>(4 * k);
+        rho(3 * t + 1) = hc + Cc * ck;
+        J.row(3 * t + 1).noalias() = Cc * Gam.middleRows<4>(4 * k);
+        rho(3 * t + 2) = he + Ce * ck;
+        J.row(3 * t + 2).noalias() = Ce * Gam.middleRows<4>(4 * k);
+        J(3 * t + 2, 2 * k) += vars[v_start + k] / p.Lf * p.dt;
+    }
+
+    H.noalias() = J.transpose() * J;
+    H += R;
+    g.noalias() = J.transpose() * rho;
+    g.noalias() += R * u;
+}
+
+// Stage-wise QP for the Riccati recursion. The state is the deviation from
+// the guess of x, y, psi, v, cte and epsi followed by the deviation of the
+// previous actuation, which turns the change of actuation cost into a
+// stage cost.
+
+void MPC_RTI::SetupRiccati(const VectorRef& state, const VectorRef& coeffs, double ref_v) {
+    size_t N = p.N;
+    const Eigen::Matrix2d Rd = Eigen::Vector2d(p.w_delta, 1.0).asDiagonal();
+    const Eigen::Matrix2d Wd = Eigen::Vector2d(p.w_ddelta, 1.0).asDiagonal();
+
+    for (size_t t = 0; t < N; t++) {
+        lq.Q[t].setZero();
+        lq.Q[t](3, 3) = 1.0;
+        lq.Q[t](4, 4) = 1.0;
+        lq.Q[t](5, 5) = 1.0;
+        q.segment<8>(8 * t) << 0.0, 0.0, 0.0, vars[v_start + t] - ref_v,
+            vars[cte_start + t], vars[epsi_start + t], 0.0, 0.0;
+        if (t == N - 1) {
+            break;
+        }
+
+        const Eigen::Vector2d ut = u.segment<2>(2 * t);
+        lq.S[t].setZero();
+        lq.R[t] = Rd;
+        r.segment<2>(2 * t) = Rd * ut;
+        if (t > 0) {
+            lq.Q[t].bottomRightCorner<2, 2>() = Wd;
+            lq.S[t].bottomRows<2>() = -Wd;
+            lq.R[t] += Wd;
+            r.segment<2>(2 * t) += Wd * (ut - u.segment<2>(2 * (t - 1)));
+        }
+        if (t + 2 < N) {
+            r.segment<2>(2 * t) += Wd * (ut - u.segment<2>(2 * (t + 1)));
+        }
+
+        double hc, he;
+        Eigen::RowVector4d Cc, Ce;
+        Outputs(t, coeffs, hc, Cc, he, Ce);
+
+        lq.A[t].setZero();
+        lq.A[t].topLeftCorner<4, 4>() = A.block<4, 4>(0, 4 * t);
+        lq.A[t].block<1, 4>(4, 0) = Cc;
+        lq.A[t].block<1, 4>(5, 0) = Ce;
+        lq.B[t].setZero();
+        lq.B[t].topRows<4>() = B.block<4, 2>(0, 2 * t);
+        lq.B[t](5, 0) = vars[v_start + t] / p.Lf * p.dt;
+        lq.B[t].bottomRows<2>().setIdentity();
+        c.segment<8>(8 * t) << d.col(t), hc - vars[cte_start + t + 1],
+            he - vars[epsi_start + t + 1], 0.0, 0.0;
+    }
+}
+
+double MPC_RTI::Feedback(const VectorRef& state, const VectorRef& coeffs, double ref_v) {
+    if (!prepared) {
+        Prepare();
+    }
+
+    size_t N = p.N;
+
+    z0 << state[0] - vars[x_start], state[1] - vars[y_start], state[2] - vars[psi_start],
+        state[3] - vars[v_start], state[4] - vars[cte_start], state[5] - vars[epsi_start], 0.0, 0.0;
+
+    if (options.kkt == CONDENSED) {
+        SetupCondensed(state, coeffs, ref_v);
+    } else {
+        SetupRiccati(state, coeffs, ref_v);
+    }
+
+    qp_iterations = SolveBoxQP();
+
+    // Update the trajectory with the linearized model
+    u += du;
+    if (options.kkt == CONDENSED) {
+        rho.noalias() += J * du;
+        const Eigen::Vector4d dp0 = z0.head<4>();
+        for (size_t t = 0; t < N; t++) {
+            Eigen::Vector4d pt = Phi.block<4, 4>(4 * t, 0) * dp0 + Gam.middleRows<4>(4 * t) * du +
+                e.segment<4>(4 * t);
+            vars[x_start + t] += pt(0);
+            vars[y_start + t] += pt(1);
+            vars[psi_start + t] += pt(2);
+            vars[v_start + t] += pt(3);
+            vars[cte_start + t] = rho(3 * t + 1);
+            vars[epsi_start + t] = rho(3 * t + 2);
+        }
+    } else {
+        lq.Simulate(z0, c, du, z);
+        for (size_t t = 0; t < N; t++) {
+            vars[x_start + t] += z(8 * t);
+            vars[y_start + t] += z(8 * t + 1);
+            vars[psi_start + t] += z(8 * t + 2);
+            vars[v_start + t] += z(8 * t + 3);
+            vars[cte_start + t] += z(8 * t + 4);
+            vars[epsi_start + t] += z(8 * t + 5);
+        }
+    }
+    for (size_t k = 0; k < N - 1; k++) {
+        vars[delta_start + k] = u(2 * k);
+        vars[a_start + k] = u(2 * k + 1);
+    }
+    prepared = false;
+
+    // Same cost as FG_eval
+    double cost = 0.0;
+    for (size_t t = 0; t < N; t++) {
+        cost += pow(vars[cte_start + t], 2);
+        cost += pow(vars[epsi_start + t], 2);
+        cost += pow(vars[v_start + t] - ref_v, 2);
+    }
+    for (size_t k = 0; k < N - 1; k++) {
+        cost += p.w_delta * pow(u(2 * k), 2);
+        cost += pow(u(2 * k + 1), 2);
+    }
+    for (size_t k = 0; k + 2 < N; k++) {
+        cost += p.w_ddelta * pow(u(2 * k + 2) - u(2 * k), 2);
+        cost += pow(u(2 * k + 3) - u(2 * k + 1), 2);
+    }
+    return cost;
+}
+
+// Gradient of the QP objective at du = x
+
+void MPC_RTI::QPGradient(const Eigen::VectorXd& x, Eigen::VectorXd& grad) {
+    if (options.kkt == CONDENSED) {
+        grad.noalias() = H * x;
+        grad += g;
+    } else {
+        lq.Gradient(z0, q, r, c, x, z, grad);
+    }
+}
+
+// Solve (H + diag(sigma)) dx = rhs
+
+bool MPC_RTI::QPStep(const Eigen::VectorXd& sigma, const Eigen::VectorXd& rhs, Eigen::VectorXd& dx) {
+    if (options.kkt == CONDENSED) {
+        K = H;
+        K.diagonal() += sigma;
+        llt.compute(K);
+        if (llt.info() != Eigen::Success) {
+            return false;
+        }
+        dx = llt.solve(rhs);
+    } else {
+        // The same system is the stage-wise QP from a zero state with
+        // -rhs as the linear term of the actuations
+        if (!lq.Factor(sigma)) {
+            return false;
+        }
+        r_step = -rhs;
+        lq.Solve(Riccati<8, 2>::VecX::Zero(), zero_q, r_step, zero_c, z, dx);
+    }
+    return true;
+}
+
+// Primal-dual interior point for
+//    min 1/2 du' H du + g' du,  lb <= du <= ub
+// stopped after max_qp_iter iterations so the time is bounded.
+
+int MPC_RTI::SolveBoxQP() {
+    const double tau = 0.995;
+    const double sigma = 0.1;
+    const double tol = 1e-8;
+
+    Eigen::VectorXd& x = du;
+    for (size_t i = 0; i < nu; i++) {
+        double m = 0.01 * (ub(i) - lb(i));
+        x(i) = std::max(lb(i) + m, std::min(ub(i) - m, 0.0));
+    }
+    ll.setOnes();
+    lu.setOnes();
+    sl = x - lb;
+    su = ub - x;
+
+    int iter = 0;
+    for (; iter < options.max_qp_iter; iter++) {
+        double mu = (sl.dot(ll) + su.dot(lu)) / (2 * nu);
+        QPGradient(x, grad);
+        if (mu < tol && (grad - ll + lu).lpNorm<Eigen::Infinity>() < tol) {
+            break;
+        }
+
+        // Eliminate the multipliers: (H + Sigma) dx = -grad + sigma mu (1/sl - 1/su)
+        sig = ll.cwiseQuotient(sl) + lu.cwiseQuotient(su);
+        rhs = -grad + sigma * mu * (sl.cwiseInverse() - su.cwiseInverse());
+        if (!QPStep(sig, rhs, dx)) {
+            break;
+        }
+        dll = sigma * mu * sl.cwiseInverse() - ll - ll.cwiseQuotient(sl).cwiseProduct(dx);
+        dlu = sigma * mu * su.cwiseInverse() - lu + lu.cwiseQuotient(su).cwiseProduct(dx);
+
+        // Fraction to the boundary
+        double alpha_p = 1.0;
+        double alpha_d = 1.0;
+        for (size_t i = 0; i < nu; i++) {
+            if (dx(i) < 0) {
+                alpha_p = std::min(alpha_p, -tau * sl(i) / dx(i));
+            } else if (dx(i) > 0) {
+                alpha_p = std::min(alpha_p, tau * su(i) / dx(i));
+            }
+            if (dll(i) < 0) {
+                alpha_d = std::min(alpha_d, -tau * ll(i) / dll(i));
+            }
+            if (dlu(i) < 0) {
+                alpha_d = std::min(alpha_d, -tau * lu(i) / dlu(i));
+            }
+        }
+
+        x += alpha_p * dx;
+        ll += alpha_d * dll;
+        lu += alpha_d * dlu;
+        sl = x - lb;
+        su = ub - x;
+    }
+    return iter;
+}
@@ -0,0 +1,127 @@
+#ifndef MPC_RTI_H
+#define MPC_RTI_H
+
+#include <cppad/cppad.hpp>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPCConfig.h"
+#include "Riccati.h"
+
+// Real time iteration solver for the same problem FG_eval encodes.
+//
+// Each tick does a single Gauss-Newton SQP step. The cost is a sum of
+// squares of linear terms so its Hessian is exact, only the curvature of
+// the dynamics is dropped.
+//
+// Prepare() runs between ticks: it linearizes the x, y, psi and v dynamics
+// around the guess in `vars` (and condenses them for CONDENSED). It does not
+// need the new telemetry. Feedback() runs when telemetry arrives: it
+// linearizes the cte and epsi rows with the new coefficients and solves the
+// QP on the actuations with a fixed maximum number of interior point
+// iterations.
+//
+// The Newton steps of the QP are computed either on the condensed Hessian
+// or, by default, with a Riccati recursion over the stages (see Riccati.h),
+// which is O(N) and does not need the condensing.
+
+class MPC_RTI {
+public:
+    typedef CPPAD_TESTVECTOR(double) Dvector;
+
+    // How the QP Newton steps are computed
+    enum KKT {
+        CONDENSED,  // dense Cholesky of the condensed Hessian
+        RICCATI     // Riccati recursion over the stages
+    };
+
+    struct Options {
+        int max_qp_iter;
+        KKT kkt;
+    };
+
+    typedef Eigen::Ref<const Eigen::VectorXd> VectorRef;
+
+    // Guess and solution, same layout as the Ipopt variables
+    Dvector vars;
+
+    // True when Prepare has been run on the current guess
+    bool prepared;
+
+    // Interior point iterations used by the last Feedback
+    int qp_iterations;
+
+    // `config` must be the one of the Ipopt formulation in MPC.cpp
+    MPC_RTI(const MPCConfig& config, const Options& options);
+
+    virtual ~MPC_RTI();
+
+    // Change how the QP Newton steps are computed
+    void SetKKT(KKT kkt);
+
+    // Linearize and condense around `vars`
+    void Prepare();
+
+    // Solve for the new initial state and coefficients and update `vars`.
+    // Returns the cost of the new trajectory.
+    double Feedback(const VectorRef& state, const VectorRef& coeffs, double ref_v);
+
+private:
+    MPCConfig p;
+    Options options;
+    size_t nu;  // number of actuation variables, 2 * (N - 1)
+
+    // Trajectory views into `vars`
+    size_t x_start, y_start, psi_start, v_start, cte_start, epsi_start, delta_start, a_start;
+
+    // Linearized x, y, psi, v dynamics, one block per step:
+    // dp[t+1] = A[t] dp[t] + B[t] du[t] + d[t]
+    Eigen::MatrixXd A;  // 4 x 4(N-1)
+    Eigen::MatrixXd B;  // 4 x 2(N-1)
+    Eigen::MatrixXd d;  // 4 x (N-1)
+
+    // Condensed: dp[t] = Phi[t] dp[0] + Gam[t] du + e[t]. Only for CONDENSED
+    Eigen::MatrixXd Phi;  // 4N x 4
+    Eigen::MatrixXd Gam;  // 4N x nu
+    Eigen::VectorXd e;    // 4N
+
+    // QP data for CONDENSED
+    Eigen::MatrixXd R;    // actuation cost, constant
+    Eigen::MatrixXd J;    // residuals of the state cost wrt du
+    Eigen::VectorXd rho;
+    Eigen::MatrixXd H;
+    Eigen::VectorXd g;
+    Eigen::MatrixXd K;
+    Eigen::LLT<Eigen::MatrixXd> llt;
+
+    // QP data for RICCATI. The state is 6 deviations of the guess plus the
+    // previous actuation, so the change of actuation cost is stage-wise.
+    Riccati<8, 2> lq;
+    Eigen::VectorXd z0;
+    Eigen::VectorXd q;
+    Eigen::VectorXd r;
+    Eigen::VectorXd c;
+    Eigen::VectorXd z;
+    Eigen::VectorXd zero_q;
+    Eigen::VectorXd zero_c;
+    Eigen::VectorXd r_step;
+
+    Eigen::VectorXd u;    // actuations of the guess
+    Eigen::VectorXd du;
+    Eigen::VectorXd lb;
+    Eigen::VectorXd ub;
+
+    // Box QP iterates: multipliers and slacks of the lower and upper
+    // bounds, and the work of each iteration. Members so Feedback does not
+    // allocate.
+    Eigen::VectorXd ll, lu, sl, su;
+    Eigen::VectorXd grad, rhs, sig, dx, dll, dlu;
+
+    void Outputs(size_t k, const VectorRef& coeffs, double& hc, Eigen::RowVector4d& Cc,
+                 double& he, Eigen::RowVector4d& Ce);
+    void SetupCondensed(const VectorRef& state, const VectorRef& coeffs, double ref_v);
+    void SetupRiccati(const VectorRef& state, const VectorRef& coeffs, double ref_v);
+    void QPGradient(const Eigen::VectorXd& x, Eigen::VectorXd& grad);
+    bool QPStep(const Eigen::VectorXd& sigma, const Eigen::VectorXd& rhs, Eigen::VectorXd& dx);
+    int SolveBoxQP();
+};
+
+#endif /* MPC_RTI_H */
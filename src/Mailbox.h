@@ -0,0 +1,73 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include <atomic>
+
+// Single slot, latest wins mailbox between one producer thread and one
+// consumer thread.
+//
+// It is a triple buffer: the producer fills its slot and swaps it with the
+// shared one, the consumer swaps its slot with the shared one when it holds
+// a value it has not taken. Neither side waits on the other and nothing is
+// allocated after construction. A value posted before the previous one was
+// taken replaces it, and is counted as dropped.
+
+template <class T>
+class Mailbox {
+public:
+    Mailbox() : back(0), front(2), shared(1), dropped(0) {}
+
+    // Producer: the slot to fill before Post
+    T& Slot() {
+        return slots[back];
+    }
+
+    // Producer: publish the slot. Returns false if a value the consumer
+    // had not taken was dropped.
+    bool Post() {
+        int old = shared.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = old & INDEX;
+        if (old & FRESH) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Consumer: whether there is a value to take
+    bool Ready() const {
+        return (shared.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+
+    // Consumer: take the latest value, if there is a new one, into Front
+    bool Take() {
+        if (!Ready()) {
+            return false;
+        }
+        int old = shared.exchange(front, std::memory_order_acq_rel);
+        front = old & INDEX;
+        return true;
+    }
+
+    // Consumer: the last value taken
+    T& Front() {
+        return slots[front];
+    }
+
+    // Values replaced before they were taken
+    size_t Dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum { INDEX = 3, FRESH = 4 };
+
+    T slots[3];
+    int back;                   // producer only
+    int front;                  // consumer only
+    std::atomic<int> shared;    // index of the shared slot, FRESH if not taken
+    std::atomic<size_t> dropped;
+};
+
+#endif /* MAILBOX_H */
@@ -0,0 +1,167 @@
+#include "Metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include "Profile.h"
+#include "TelemetryLog.h"
+#include "Trace.h"
+
+// Upper bounds of the exported buckets, in seconds. The histograms are
+// finer; each exported bucket counts the ones that end below its bound.
+static const double bounds[] = {
+    1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+    1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0
+};
+
+// Iterations, unscaled
+static const double iteration_bounds[] = {1, 2, 3, 5, 10, 20, 50, 100, 200, 500};
+
+// Differences between actuations, in radians or throttle
+static const double diff_bounds[] = {1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 0.1, 1.0};
+
+Metrics::Metrics()
+    : solves(0), fallbacks(0), deadline_misses(0), frames(0), dropped(0), sessions(0),
+      connections(0), warmup_seconds(0), first_fast_solve_seconds(0), log(NULL) {}
+
+void Metrics::Solved(double solve_time, int iterations, bool fallback, bool deadline_miss) {
+    this->solve_time.Add(uint64_t(solve_time * 1e9));
+    this->iterations.Add(iterations > 0 ? iterations : 0);
+    solves.fetch_add(1, std::memory_order_relaxed);
+    if (fallback) {
+        fallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (deadline_miss) {
+        deadline_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::Compared(double steer_diff, double throttle_diff) {
+    rti_steer_diff.Add(uint64_t(steer_diff * 1e9));
+    rti_throttle_diff.Add(uint64_t(throttle_diff * 1e9));
+}
+
+static void Append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void Append(std::string& out, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(line, n < int(sizeof(line)) ? n : sizeof(line) - 1);
+    }
+}
+
+static void Header(std::string& out, const char* name, const char* type, const char* help) {
+    Append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void Counter(std::string& out, const char* name, const char* help, uint64_t value) {
+    Header(out, name, "counter", help);
+    Append(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+static void Gauge(std::string& out, const char* name, const char* help, int64_t value) {
+    Header(out, name, "gauge", help);
+    Append(out, "%s %lld\n", name, (long long)value);
+}
+
+static void Gauge(std::string& out, const char* name, const char* help, double value) {
+    Header(out, name, "gauge", help);
+    Append(out, "%s %g\n", name, value);
+}
+
+// The samples of `histogram` scaled by `scale` into the `bounds`, with
+// `labels` ("" or `key="value"`) on every sample
+static void Samples(std::string& out, const char* name, const char* labels,
+                    const Histogram& histogram, double scale, const double* bounds,
+                    size_t n_bounds) {
+    const char* comma = labels[0] != '\0' ? "," : "";
+    uint64_t below = 0;
+    size_t bucket = 0;
+    for (size_t i = 0; i < n_bounds; i++) {
+        while (bucket < Histogram::BUCKETS && Histogram::Upper(bucket) * scale <= bounds[i]) {
+            below += histogram.Bucket(bucket++);
+        }
+        Append(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, comma, bounds[i],
+               (unsigned long long)below);
+    }
+    while (bucket < Histogram::BUCKETS) {
+        below += histogram.Bucket(bucket++);
+    }
+    // The count is the +Inf bucket so they agree while threads add
+    Append(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, comma,
+           (unsigned long long)below);
+    if (labels[0] != '\0') {
+        Append(out, "%s_sum{%s} %g\n", name, labels, histogram.Sum() * scale);
+        Append(out, "%s_count{%s} %llu\n", name, labels, (unsigned long long)below);
+    } else {
+        Append(out, "%s_sum %g\n", name, histogram.Sum() * scale);
+        Append(out, "%s_count %llu\n", name, (unsigned long long)below);
+    }
+}
+
+void Metrics::Write(std::string& out) const {
+    const size_t n_bounds = sizeof(bounds) / sizeof(bounds[0]);
+    const size_t n_iteration_bounds = sizeof(iteration_bounds) / sizeof(iteration_bounds[0]);
+    const size_t n_diff_bounds = sizeof(diff_bounds) / sizeof(diff_bounds[0]);
+    out.clear();
+
+    Header(out, "mpc_solve_seconds", "histogram", "Time of MPC::Solve.");
+    Samples(out, "mpc_solve_seconds", "", solve_time, 1e-9, bounds, n_bounds);
+    Header(out, "mpc_solve_iterations", "histogram", "Ipopt iterations, or RTI QP iterations, per solve.");
+    Samples(out, "mpc_solve_iterations", "", iterations, 1.0, iteration_bounds, n_iteration_bounds);
+    Header(out, "mpc_rti_steer_diff", "histogram",
+           "Difference between the RTI and Ipopt steering, in radians, with --backend=compare.");
+    Samples(out, "mpc_rti_steer_diff", "", rti_steer_diff, 1e-9, diff_bounds, n_diff_bounds);
+    Header(out, "mpc_rti_throttle_diff", "histogram",
+           "Difference between the RTI and Ipopt throttle with --backend=compare.");
+    Samples(out, "mpc_rti_throttle_diff", "", rti_throttle_diff, 1e-9, diff_bounds, n_diff_bounds);
+    Counter(out, "mpc_solves_total", "Solves.", solves.load(std::memory_order_relaxed));
+    Counter(out, "mpc_fallbacks_total", "Solves that drove the previous plan, or nothing, as Ipopt failed.",
+            fallbacks.load(std::memory_order_relaxed));
+    Counter(out, "mpc_deadline_misses_total", "Ipopt solves stopped by the deadline.",
+            deadline_misses.load(std::memory_order_relaxed));
+    Counter(out, "mpc_frames_total", "Telemetry frames given to a session.",
+            frames.load(std::memory_order_relaxed));
+    Counter(out, "mpc_dropped_frames_total", "Frames replaced by a newer one before they were solved.",
+            dropped.load(std::memory_order_relaxed));
+    Gauge(out, "mpc_sessions", "Open simulator sessions.", sessions.load(std::memory_order_relaxed));
+    Counter(out, "mpc_connections_total", "Simulator sessions opened.",
+            connections.load(std::memory_order_relaxed));
+    Counter(out, "mpc_log_dropped_records_total", "Records --record lost to full rings.",
+            log != NULL ? log->Dropped() : 0);
+    Counter(out, "mpc_trace_dropped_events_total", "Events --trace lost to full rings.",
+            Trace::Dropped());
+    Gauge(out, "mpc_startup_warmup_seconds", "Time of the warm-up before listening.",
+          warmup_seconds);
+    Gauge(out, "mpc_startup_first_fast_solve_seconds",
+          "Time from the start of the process to the first solve as fast as the steady state.",
+          first_fast_solve_seconds);
+
+    Header(out, "mpc_stage_seconds", "histogram", "Time of each stage of a tick, see Profile.h.");
+    for (int i = 0; i < Profile::STAGES; i++) {
+        Profile::Stage stage = Profile::Stage(i);
+        char labels[64];
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", Profile::Name(stage));
+        Samples(out, "mpc_stage_seconds", labels, Profile::Get(stage), 1e-9, bounds, n_bounds);
+    }
+
+    // With --counters, mpc_stage_cycles_total and so on
+    if (!PerfCounters::Enabled()) {
+        return;
+    }
+    for (int c = 0; c < PerfCounters::COUNTERS; c++) {
+        PerfCounters::Counter counter = PerfCounters::Counter(c);
+        char name[64];
+        char help[128];
+        snprintf(name, sizeof(name), "mpc_stage_%s_total", PerfCounters::Name(counter));
+        snprintf(help, sizeof(help), "Hardware %s counted in each stage.", PerfCounters::Name(counter));
+        Header(out, name, "counter", help);
+        for (int i = 0; i < Profile::STAGES; i++) {
+            Profile::Stage stage = Profile::Stage(i);
+            Append(out, "%s{stage=\"%s\"} %llu\n", name, Profile::Name(stage),
+                   (unsigned long long)Profile::Counter(stage, counter));
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "Histogram.h"
+
+class LogWriter;
+
+// Counters of the server for the /metrics endpoint.
+//
+// The event loop and the solve tasks update them with relaxed atomics and
+// the endpoint reads them the same way, so a scrape never waits for, or
+// makes wait, a tick. Write renders them with the stage times of Profile
+// and hardware counters of Profile, and the records and events the log and
+// the trace dropped, in the Prometheus text exposition format.
+
+struct Metrics {
+    Histogram solve_time;                   // of MPC::Solve, ns
+    Histogram iterations;                   // of Ipopt, or of the RTI QP
+    Histogram rti_steer_diff;               // RTI vs Ipopt with COMPARE, nrad
+    Histogram rti_throttle_diff;            // the same for the throttle, 1e-9
+    std::atomic<uint64_t> solves;
+    std::atomic<uint64_t> fallbacks;
+    std::atomic<uint64_t> deadline_misses;
+    std::atomic<uint64_t> frames;           // telemetry posted to a session
+    std::atomic<uint64_t> dropped;          // replaced before it was solved
+    std::atomic<int64_t> sessions;          // open
+    std::atomic<uint64_t> connections;      // ever opened
+
+    // Set by the warm-up, before the server listens: its length and the
+    // time from the start of the process to the first solve as fast as
+    // the steady state
+    double warmup_seconds;
+    double first_fast_solve_seconds;
+
+    // With --record, for the records its rings dropped
+    const LogWriter* log;
+
+    Metrics();
+
+    // Solve task: count a solve
+    void Solved(double solve_time, int iterations, bool fallback, bool deadline_miss);
+
+    // Solve task: count the difference between RTI and Ipopt of a COMPARE
+    // solve
+    void Compared(double steer_diff, double throttle_diff);
+
+    // Replace `out` with all the metrics
+    void Write(std::string& out) const;
+
+private:
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+};
+
+#endif /* METRICS_H */
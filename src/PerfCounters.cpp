@@ -0,0 +1,121 @@
+#include "PerfCounters.h"
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// The counter group of a thread, closed when the thread ends
+struct Group {
+    int fds[PerfCounters::COUNTERS];
+    bool opened;        // tried to open
+    bool valid;
+
+    Group() : opened(false), valid(false) {
+        for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+            fds[i] = -1;
+        }
+    }
+
+    ~Group() {
+        for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+    }
+
+    void Open();
+};
+
+thread_local Group group;
+
+const char* names[PerfCounters::COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+#if defined(__linux__)
+
+const uint64_t configs[PerfCounters::COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+void Group::Open() {
+    opened = true;
+    for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+        if (fds[i] < 0) {
+            return;
+        }
+    }
+    valid = ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0;
+}
+
+void ReadGroup(Group& g, PerfCounters::Values& values) {
+    // PERF_FORMAT_GROUP: nr, time_enabled, time_running, value[nr]
+    uint64_t data[3 + PerfCounters::COUNTERS];
+    if (read(g.fds[0], data, sizeof(data)) != ssize_t(sizeof(data)) ||
+        data[0] != PerfCounters::COUNTERS) {
+        memset(&values, 0, sizeof(values));
+        return;
+    }
+    double scale = data[2] > 0 ? double(data[1]) / data[2] : 0.0;
+    for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+        values.value[i] = data[1] == data[2] ? data[3 + i] : uint64_t(data[3 + i] * scale);
+    }
+}
+
+#else
+
+void Group::Open() {
+    opened = true;
+}
+
+void ReadGroup(Group&, PerfCounters::Values& values) {
+    memset(&values, 0, sizeof(values));
+}
+
+#endif
+
+}
+
+std::atomic<bool> PerfCounters::enabled(false);
+
+bool PerfCounters::Enable() {
+    if (!group.opened) {
+        group.Open();
+    }
+    enabled.store(group.valid);
+    return group.valid;
+}
+
+void PerfCounters::Read(Values& values) {
+    if (!group.opened) {
+        group.Open();
+    }
+    if (!group.valid) {
+        memset(&values, 0, sizeof(values));
+        return;
+    }
+    ReadGroup(group, values);
+}
+
+const char* PerfCounters::Name(Counter counter) {
+    return names[counter];
+}
@@ -0,0 +1,47 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Hardware counters of the calling thread through Linux perf_event_open,
+// for the stages of Profile (see --counters).
+//
+// Each thread that reads opens its own group of the four counters on its
+// first Read, counting user space only, and reads them all with one
+// read(2), so a stage costs two system calls when enabled. When the
+// kernel multiplexes the group the values are scaled by the time it ran.
+// A thread that cannot open the group (no PMU in a virtual machine,
+// perf_event_paranoid) reads zeros.
+
+struct PerfCounters {
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,       // last level cache
+        BRANCH_MISSES,
+        COUNTERS
+    };
+
+    struct Values {
+        uint64_t value[COUNTERS];
+    };
+
+    // Count from now on. False, and not enabled, if the calling thread
+    // cannot open the counters.
+    static bool Enable();
+
+    static bool Enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // The counters of the calling thread so far
+    static void Read(Values& values);
+
+    static const char* Name(Counter counter);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,85 @@
+#include "Profile.h"
+#include <stdio.h>
+#include <atomic>
+
+static Histogram histograms[Profile::STAGES];
+static std::atomic<uint64_t> counters[Profile::STAGES][PerfCounters::COUNTERS];
+
+static const char* names[Profile::STAGES] = {
+    "copy", "has_data", "json", "parse", "polyfit",
+    "lock", "tape", "ipopt", "eval", "rti", "serialize", "send"
+};
+
+void Profile::Add(Stage stage, uint64_t ns) {
+    histograms[stage].Add(ns);
+}
+
+void Profile::AddCounters(Stage stage, const PerfCounters::Values& start,
+                          const PerfCounters::Values& end) {
+    for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+        counters[stage][i].fetch_add(end.value[i] - start.value[i], std::memory_order_relaxed);
+    }
+}
+
+void Profile::Clear() {
+    for (int i = 0; i < STAGES; i++) {
+        histograms[i].Clear();
+        for (int c = 0; c < PerfCounters::COUNTERS; c++) {
+            counters[i][c].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const Histogram& Profile::Get(Stage stage) {
+    return histograms[stage];
+}
+
+const char* Profile::Name(Stage stage) {
+    return names[stage];
+}
+
+uint64_t Profile::Counter(Stage stage, PerfCounters::Counter counter) {
+    return counters[stage][counter].load(std::memory_order_relaxed);
+}
+
+void Profile::Print(std::ostream& out) {
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %8s %9s %9s %9s %9s %9s\n",
+             "stage (us)", "count", "mean", "p50", "p90", "p99", "max");
+    out << line;
+    for (int i = 0; i < STAGES; i++) {
+        const Histogram& h = histograms[i];
+        uint64_t count = h.Count();
+        if (count == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-10s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", names[i],
+                 (unsigned long long)count, 1e-3 * h.Sum() / count, 1e-3 * h.Percentile(0.5),
+                 1e-3 * h.Percentile(0.9), 1e-3 * h.Percentile(0.99), 1e-3 * h.Max());
+        out << line;
+    }
+    if (!PerfCounters::Enabled()) {
+        return;
+    }
+
+    // Per run, and cache misses per thousand instructions: a low IPC with
+    // many misses points at memory rather than arithmetic
+    snprintf(line, sizeof(line), "%-10s %11s %11s %6s %9s %9s %13s\n",
+             "stage", "cycles", "instr", "IPC", "LLC miss", "br miss", "miss/kinstr");
+    out << line;
+    for (int i = 0; i < STAGES; i++) {
+        uint64_t count = histograms[i].Count();
+        Stage stage = Stage(i);
+        double cycles = Counter(stage, PerfCounters::CYCLES);
+        double instructions = Counter(stage, PerfCounters::INSTRUCTIONS);
+        if (count == 0 || cycles == 0) {
+            continue;
+        }
+        double misses = Counter(stage, PerfCounters::CACHE_MISSES);
+        snprintf(line, sizeof(line), "%-10s %11.0f %11.0f %6.2f %9.1f %9.1f %13.2f\n", names[i],
+                 cycles / count, instructions / count, instructions / cycles, misses / count,
+                 double(Counter(stage, PerfCounters::BRANCH_MISSES)) / count,
+                 instructions > 0 ? 1000.0 * misses / instructions : 0.0);
+        out << line;
+    }
+}
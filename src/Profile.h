@@ -0,0 +1,132 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <ostream>
+#include "Histogram.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+
+// Time spent in each stage of a tick, from the frame to the reply, so a
+// slow tick can be put down to the parser, the fit or the solver.
+//
+// Every stage has a Histogram of its durations in nanoseconds shared by
+// all threads and sessions. Now reads CLOCK_MONOTONIC, which the vDSO
+// answers without a system call, so a stage costs two clock reads and an
+// Add. With --trace the stages are also events of the Trace, and with
+// --counters the hardware counters of each stage are added up too, see
+// PerfCounters.h.
+
+struct Profile {
+    enum Stage {
+        COPY,       // the text frame copied for the json parser
+        HAS_DATA,   // the json array found in the frame
+        JSON,       // json::parse and reading the telemetry out of it
+        PARSE,      // ParseTelemetry or ReadTelemetryFrame, in place
+        POLYFIT,    // the waypoints to car coordinates and the fit
+        LOCK,       // the wait for MPC_NLP::mutex, with a serial linear solver
+        TAPE,       // the new road and speed given to the tape or provider
+        IPOPT,      // Ipopt iterations, without the function evaluations
+        EVAL,       // function and derivative evaluations asked by Ipopt
+        RTI,        // the real time iteration
+        SERIALIZE,  // the reply written by SteerWriter
+        SEND,       // ws.send
+        STAGES
+    };
+
+    // Monotonic time in nanoseconds
+    static uint64_t Now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // Where a stage started: the time and, with counters, the counters of
+    // the thread
+    struct Mark {
+        uint64_t time;
+        PerfCounters::Values counters;
+    };
+
+    static Mark Start() {
+        Mark mark;
+        mark.time = Now();
+        if (PerfCounters::Enabled()) {
+            PerfCounters::Read(mark.counters);
+        }
+        return mark;
+    }
+
+    static void Add(Stage stage, uint64_t ns);
+
+    // Add the counters `end` - `start` to `stage`
+    static void AddCounters(Stage stage, const PerfCounters::Values& start,
+                            const PerfCounters::Values& end);
+
+    // Add the time, and the counters, since `start`
+    static void Since(Stage stage, const Mark& start) {
+        uint64_t now = Now();
+        Add(stage, now - start.time);
+        if (Trace::Enabled()) {
+            Trace::Complete(Name(stage), start.time, now);
+        }
+        if (PerfCounters::Enabled()) {
+            PerfCounters::Values end;
+            PerfCounters::Read(end);
+            AddCounters(stage, start.counters, end);
+        }
+    }
+
+    // Empty the histograms and the counters, as after the warm-up
+    static void Clear();
+
+    static const Histogram& Get(Stage stage);
+    static const char* Name(Stage stage);
+
+    // Sum of `counter` over the runs of `stage`
+    static uint64_t Counter(Stage stage, PerfCounters::Counter counter);
+
+    // A table of the count, mean, percentiles and maximum of every stage
+    // that ran, in microseconds, and with counters a table of them per run
+    static void Print(std::ostream& out);
+
+    // Adds the time of its scope to `stage`
+    class Scope {
+    public:
+        explicit Scope(Stage stage) : stage(stage), start(Start()) {}
+        ~Scope() {
+            Since(stage, start);
+        }
+    private:
+        Stage stage;
+        Mark start;
+    };
+
+    // Adds the time of its scope to `total`, and the counters to
+    // `counters`, for a stage spread over many calls. Traced as `name`.
+    class Watch {
+    public:
+        Watch(uint64_t& total, PerfCounters::Values& counters, const char* name)
+            : total(total), counters(counters), name(name), start(Start()) {}
+        ~Watch() {
+            uint64_t now = Now();
+            total += now - start.time;
+            Trace::Complete(name, start.time, now);
+            if (PerfCounters::Enabled()) {
+                PerfCounters::Values end;
+                PerfCounters::Read(end);
+                for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+                    counters.value[i] += end.value[i] - start.counters.value[i];
+                }
+            }
+        }
+    private:
+        uint64_t& total;
+        PerfCounters::Values& counters;
+        const char* name;
+        Mark start;
+    };
+};
+
+#endif /* PROFILE_H */
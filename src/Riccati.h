@@ -0,0 +1,131 @@
+#ifndef RICCATI_H
+#define RICCATI_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/StdVector"
+
+// Riccati recursion for stage-wise linear quadratic problems
+//
+//    min  sum_t 1/2 z'Q z + z'S u + 1/2 u'R u + q'z + r'u
+//    s.t. z[t+1] = A z[t] + B u[t] + c[t],  z[0] = z0
+//
+// over t = 0..N-1, the last stage having no input. Solving the KKT system
+// this way is O(N) with fixed-size NX x NX and NU x NU blocks, instead of
+// the O(N^3) of factoring the condensed Hessian.
+//
+// Vectors over the horizon are stored flat: z and q have NX * N entries,
+// u, r and reg NU * (N - 1), and c NX * (N - 1).
+
+template <int NX, int NU>
+class Riccati {
+public:
+    typedef Eigen::Matrix<double, NX, NX> MatXX;
+    typedef Eigen::Matrix<double, NX, NU> MatXU;
+    typedef Eigen::Matrix<double, NU, NX> MatUX;
+    typedef Eigen::Matrix<double, NU, NU> MatUU;
+    typedef Eigen::Matrix<double, NX, 1> VecX;
+    typedef Eigen::Matrix<double, NU, 1> VecU;
+
+    size_t N;
+
+    // Stage data
+    std::vector<MatXX, Eigen::aligned_allocator<MatXX> > A;
+    std::vector<MatXU, Eigen::aligned_allocator<MatXU> > B;
+    std::vector<MatXX, Eigen::aligned_allocator<MatXX> > Q;
+    std::vector<MatXU, Eigen::aligned_allocator<MatXU> > S;
+    std::vector<MatUU, Eigen::aligned_allocator<MatUU> > R;
+
+    Riccati() : N(0) {}
+
+    void Resize(size_t N) {
+        this->N = N;
+        A.resize(N - 1);
+        B.resize(N - 1);
+        Q.resize(N);
+        S.resize(N - 1);
+        R.resize(N - 1);
+        P.resize(N);
+        G.resize(N - 1);
+        llt.resize(N - 1);
+        p.resize(NX * N);
+        h.resize(NU * (N - 1));
+    }
+
+    // Backward sweep on the quadratic terms, with `reg` added to the
+    // diagonal of R. Returns false if a stage is not positive definite.
+    bool Factor(const Eigen::VectorXd& reg) {
+        P[N - 1] = Q[N - 1];
+        for (size_t t = N - 1; t-- > 0;) {
+            const MatXX PA = P[t + 1] * A[t];
+            const MatXU PB = P[t + 1] * B[t];
+            MatUU Ru = R[t] + B[t].transpose() * PB;
+            Ru.diagonal() += reg.template segment<NU>(NU * t);
+            llt[t].compute(Ru);
+            if (llt[t].info() != Eigen::Success) {
+                return false;
+            }
+            G[t] = S[t].transpose() + B[t].transpose() * PA;
+            P[t] = Q[t] + A[t].transpose() * PA - G[t].transpose() * llt[t].solve(G[t]);
+            P[t] = 0.5 * (P[t] + P[t].transpose()).eval();
+        }
+        return true;
+    }
+
+    // Solve with the given linear terms using the last Factor.
+    void Solve(const VecX& z0, const Eigen::VectorXd& q, const Eigen::VectorXd& r,
+               const Eigen::VectorXd& c, Eigen::VectorXd& z, Eigen::VectorXd& u) {
+        p.template segment<NX>(NX * (N - 1)) = q.template segment<NX>(NX * (N - 1));
+        for (size_t t = N - 1; t-- > 0;) {
+            const VecX w = P[t + 1] * c.template segment<NX>(NX * t) + p.template segment<NX>(NX * (t + 1));
+            h.template segment<NU>(NU * t) = r.template segment<NU>(NU * t) + B[t].transpose() * w;
+            p.template segment<NX>(NX * t) = q.template segment<NX>(NX * t) + A[t].transpose() * w -
+                G[t].transpose() * llt[t].solve(h.template segment<NU>(NU * t));
+        }
+
+        z.template segment<NX>(0) = z0;
+        for (size_t t = 0; t < N - 1; t++) {
+            const VecX zt = z.template segment<NX>(NX * t);
+            const VecU ut = -llt[t].solve(G[t] * zt + h.template segment<NU>(NU * t));
+            u.template segment<NU>(NU * t) = ut;
+            z.template segment<NX>(NX * (t + 1)) = A[t] * zt + B[t] * ut + c.template segment<NX>(NX * t);
+        }
+    }
+
+    // Trajectory of the states for the inputs u
+    void Simulate(const VecX& z0, const Eigen::VectorXd& c, const Eigen::VectorXd& u,
+                  Eigen::VectorXd& z) const {
+        z.template segment<NX>(0) = z0;
+        for (size_t t = 0; t < N - 1; t++) {
+            z.template segment<NX>(NX * (t + 1)) = A[t] * z.template segment<NX>(NX * t) +
+                B[t] * u.template segment<NU>(NU * t) + c.template segment<NX>(NX * t);
+        }
+    }
+
+    // Gradient of the cost with respect to u, with the states eliminated
+    // through the dynamics. `z` is filled with the state trajectory.
+    void Gradient(const VecX& z0, const Eigen::VectorXd& q, const Eigen::VectorXd& r,
+                  const Eigen::VectorXd& c, const Eigen::VectorXd& u, Eigen::VectorXd& z,
+                  Eigen::VectorXd& grad) const {
+        Simulate(z0, c, u, z);
+        VecX lambda = Q[N - 1] * z.template segment<NX>(NX * (N - 1)) +
+            q.template segment<NX>(NX * (N - 1));
+        for (size_t t = N - 1; t-- > 0;) {
+            const VecX zt = z.template segment<NX>(NX * t);
+            const VecU ut = u.template segment<NU>(NU * t);
+            grad.template segment<NU>(NU * t) = S[t].transpose() * zt + R[t] * ut +
+                r.template segment<NU>(NU * t) + B[t].transpose() * lambda;
+            lambda = Q[t] * zt + S[t] * ut + q.template segment<NX>(NX * t) + A[t].transpose() * lambda;
+        }
+    }
+
+private:
+    std::vector<MatXX, Eigen::aligned_allocator<MatXX> > P;
+    std::vector<MatUX, Eigen::aligned_allocator<MatUX> > G;
+    std::vector<Eigen::LLT<MatUU>, Eigen::aligned_allocator<Eigen::LLT<MatUU> > > llt;
+    Eigen::VectorXd p;
+    Eigen::VectorXd h;
+};
+
+#endif /* RICCATI_H */
@@ -0,0 +1,48 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <utility>
+#include <atomic>
+
+// Bounded ring of N values between one producer thread and one consumer
+// thread, exchanged by swapping so values that own memory, like strings,
+// hand it over without copying. Neither side waits on the other and
+// nothing is allocated after construction.
+
+template <class T, size_t N>
+class Ring {
+public:
+    Ring() : head(0), tail(0) {}
+
+    // Producer: swap `value` into the ring. Returns false, leaving it, if
+    // the ring is full.
+    bool Give(T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        std::swap(slots[t % N], value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: swap the oldest value out of the ring into `value`. Returns
+    // false if the ring is empty.
+    bool Take(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::swap(slots[h % N], value);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[N];
+    std::atomic<size_t> head;   // values taken, consumer only writes it
+    std::atomic<size_t> tail;   // values given, producer only writes it
+};
+
+#endif /* RING_H */
@@ -0,0 +1,54 @@
+#include "SteerWriter.h"
+#include "BinaryProtocol.h"
+#include "Grisu.h"
+
+SteerWriter::SteerWriter() : decimate(1) {
+    buffer.reserve(1024);
+}
+
+void SteerWriter::Begin(double steer, double throttle) {
+    buffer.assign("42[\"steer\",{");
+    Key("steering_angle");
+    Number(steer);
+    Key("throttle");
+    Number(throttle);
+}
+
+const std::string& SteerWriter::End() {
+    buffer += "}]";
+    return buffer;
+}
+
+const std::string& SteerWriter::Actuation(uint32_t sequence, double steer, double throttle,
+                                          bool fallback) {
+    ActuationFrame frame;
+    frame.magic = ACTUATION_MAGIC;
+    frame.version = PROTOCOL_VERSION;
+    frame.flags = fallback ? ActuationFrame::FALLBACK : 0;
+    frame.sequence = sequence;
+    frame.reserved = 0;
+    frame.steering_angle = steer;
+    frame.throttle = throttle;
+    buffer.assign(reinterpret_cast<const char*>(&frame), sizeof(frame));
+    return buffer;
+}
+
+void SteerWriter::Swap(std::string& message) {
+    buffer.swap(message);
+    buffer.clear();
+    buffer.reserve(1024);
+}
+
+void SteerWriter::Key(const char* key) {
+    if (buffer[buffer.size() - 1] != '{') {
+        buffer += ',';
+    }
+    buffer += '"';
+    buffer += key;
+    buffer += "\":";
+}
+
+void SteerWriter::Number(double value) {
+    char digits[DOUBLE_CHARS];
+    buffer.append(digits, WriteDouble(value, digits));
+}
@@ -0,0 +1,58 @@
+#ifndef STEER_WRITER_H
+#define STEER_WRITER_H
+
+#include <stdint.h>
+#include <string>
+
+// Writes the steer reply, 42["steer",{...}], into a buffer it keeps, so a
+// session builds every reply in the same memory without a json tree. Binary
+// clients get an ActuationFrame (see BinaryProtocol.h) in the same buffer.
+//
+// Numbers are written with the fewest digits that read back as the same
+// double, see Grisu.h. The visualisation arrays can be thinned out with
+// `decimate`. Swap hands a message over without copying it.
+
+class SteerWriter {
+public:
+    // Keep every `decimate`-th point of the mpc_ and next_ arrays, and the
+    // last one; leave the arrays empty when 0
+    int decimate;
+
+    SteerWriter();
+
+    void Begin(double steer, double throttle);
+
+    // Array `key` of value(i) for i in [0, n)
+    template <class F>
+    void Array(const char* key, int n, F value) {
+        Key(key);
+        buffer += '[';
+        if (decimate > 0 && n > 0) {
+            for (int i = 0; i < n - 1; i += decimate) {
+                Number(value(i));
+                buffer += ',';
+            }
+            Number(value(n - 1));
+        }
+        buffer += ']';
+    }
+
+    // The message
+    const std::string& End();
+
+    // The actuation frame answering the binary telemetry frame `sequence`
+    const std::string& Actuation(uint32_t sequence, double steer, double throttle,
+                                 bool fallback);
+
+    // Hand the message over in `message`, and write the next one into the
+    // memory `message` had
+    void Swap(std::string& message);
+
+private:
+    std::string buffer;
+
+    void Key(const char* key);
+    void Number(double value);
+};
+
+#endif /* STEER_WRITER_H */
@@ -0,0 +1,215 @@
+#include "Telemetry.h"
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include "MPC_Kernel.h"
+
+// A pass over the frame that hands each key of the telemetry object to the
+// code that wants it and skips the values nobody asked for.
+
+namespace {
+
+class Scanner {
+public:
+    Scanner(const char* data, size_t length) : p(data), end(data + length) {}
+
+    bool AtEnd() {
+        Space();
+        return p == end;
+    }
+
+    // Consume `c`, after any white space
+    bool Expect(char c) {
+        Space();
+        if (p == end || *p != c) {
+            return false;
+        }
+        p++;
+        return true;
+    }
+
+    // Consume the literal `s` as is
+    bool Literal(const char* s) {
+        size_t n = strlen(s);
+        if (size_t(end - p) < n || memcmp(p, s, n) != 0) {
+            return false;
+        }
+        p += n;
+        return true;
+    }
+
+    // A string without escapes, left in the frame as [begin, begin + length)
+    bool String(const char*& begin, size_t& length) {
+        if (!Expect('"')) {
+            return false;
+        }
+        begin = p;
+        while (p != end && *p != '"') {
+            if (*p == '\\') {
+                return false;
+            }
+            p++;
+        }
+        if (p == end) {
+            return false;
+        }
+        length = p - begin;
+        p++;
+        return true;
+    }
+
+    // A finite json number. strtod also takes nan, inf and hex floats, so
+    // what it read has to be json, and it overflows to inf.
+    bool Number(double& value) {
+        Space();
+        // strtod stops at the closing bracket of the frame at the latest
+        char* stop;
+        value = strtod(p, &stop);
+        if (stop == p || stop > end || !std::isfinite(value)) {
+            return false;
+        }
+        for (const char* c = p; c != stop; c++) {
+            if (!((*c >= '0' && *c <= '9') || *c == '-' || *c == '+' || *c == '.' ||
+                  *c == 'e' || *c == 'E')) {
+                return false;
+            }
+        }
+        p = stop;
+        return true;
+    }
+
+    // An array of numbers, into `values`
+    bool Numbers(Waypoints& values) {
+        double buffer[MAX_WAYPOINTS];
+        int n = 0;
+        if (!Expect('[')) {
+            return false;
+        }
+        if (!Expect(']')) {
+            do {
+                if (n == MAX_WAYPOINTS || !Number(buffer[n++])) {
+                    return false;
+                }
+            } while (Expect(','));
+            if (!Expect(']')) {
+                return false;
+            }
+        }
+        values.resize(n);
+        for (int i = 0; i < n; i++) {
+            values[i] = buffer[i];
+        }
+        return true;
+    }
+
+    // Any value
+    bool Skip() {
+        Space();
+        if (p == end) {
+            return false;
+        }
+        const char* begin;
+        size_t length;
+        double value;
+        switch (*p) {
+            case '"':
+                return String(begin, length);
+            case '[':
+            case '{': {
+                char close = *p == '[' ? ']' : '}';
+                p++;
+                if (Expect(close)) {
+                    return true;
+                }
+                do {
+                    if (close == '}' && !(String(begin, length) && Expect(':'))) {
+                        return false;
+                    }
+                    if (!Skip()) {
+                        return false;
+                    }
+                } while (Expect(','));
+                return Expect(close);
+            }
+            case 't':
+                return Literal("true");
+            case 'f':
+                return Literal("false");
+            case 'n':
+                return Literal("null");
+            default:
+                return Number(value);
+        }
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    void Space() {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+};
+
+bool Is(const char* key, size_t length, const char* name) {
+    return length == strlen(name) && memcmp(key, name, length) == 0;
+}
+
+}  // namespace
+
+bool ParseTelemetry(const char* data, size_t length, Telemetry& telemetry) {
+    // The closing bracket is what keeps strtod inside the frame
+    if (length < 2 || data[length - 1] != ']') {
+        return false;
+    }
+    Scanner scanner(data, length);
+    const char* key;
+    size_t key_length;
+    if (!scanner.Literal("42") || !scanner.Expect('[') || !scanner.String(key, key_length) ||
+        !Is(key, key_length, "telemetry") || !scanner.Expect(',') || !scanner.Expect('{')) {
+        return false;
+    }
+
+    enum { PTSX = 1, PTSY = 2, X = 4, Y = 8, PSI = 16, SPEED = 32, ALL = 63 };
+    int found = 0;
+    if (!scanner.Expect('}')) {
+        do {
+            if (!scanner.String(key, key_length) || !scanner.Expect(':')) {
+                return false;
+            }
+            bool ok;
+            if (Is(key, key_length, "ptsx")) {
+                ok = scanner.Numbers(telemetry.ptsx);
+                found |= PTSX;
+            } else if (Is(key, key_length, "ptsy")) {
+                ok = scanner.Numbers(telemetry.ptsy);
+                found |= PTSY;
+            } else if (Is(key, key_length, "x")) {
+                ok = scanner.Number(telemetry.px);
+                found |= X;
+            } else if (Is(key, key_length, "y")) {
+                ok = scanner.Number(telemetry.py);
+                found |= Y;
+            } else if (Is(key, key_length, "psi")) {
+                ok = scanner.Number(telemetry.psi);
+                found |= PSI;
+            } else if (Is(key, key_length, "speed")) {
+                ok = scanner.Number(telemetry.v);
+                found |= SPEED;
+            } else {
+                ok = scanner.Skip();
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (scanner.Expect(','));
+        if (!scanner.Expect('}')) {
+            return false;
+        }
+    }
+    telemetry.binary = false;
+    return found == ALL && telemetry.ptsx.size() == telemetry.ptsy.size() &&
+        telemetry.ptsx.size() > KERNEL_ORDER && scanner.Expect(']') && scanner.AtEnd();
+}
@@ -0,0 +1,37 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Eigen-3.3/Eigen/Core"
+
+// Most waypoints a telemetry message may have. The simulator sends 6.
+const int MAX_WAYPOINTS = 32;
+
+// Waypoint coordinates, stored in place so filling them does not allocate
+typedef Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::DontAlign, MAX_WAYPOINTS, 1> Waypoints;
+
+// Telemetry of one message, parsed on the event loop
+struct Telemetry {
+    Waypoints ptsx;
+    Waypoints ptsy;
+    double px;
+    double py;
+    double psi;
+    double v;
+
+    // Came in a binary frame (see BinaryProtocol.h), to be answered with an
+    // actuation frame that echoes `sequence`
+    bool binary;
+    uint32_t sequence;
+};
+
+// Fast path for the messages of the simulator. Fills `telemetry` from a
+// 42["telemetry",{...}] frame in one pass over `data`, which need not be
+// null terminated, without copying it or building a json tree. Returns
+// false for anything else (other events, manual driving, more than
+// MAX_WAYPOINTS waypoints, KERNEL_ORDER or fewer to fit the road to, or a
+// frame it does not understand), which is left to the json parser.
+bool ParseTelemetry(const char* data, size_t length, Telemetry& telemetry);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,228 @@
+#include "TelemetryLog.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+static_assert(sizeof(LogHeader) == 16, "LogHeader has padding");
+static_assert(sizeof(LogRecord) == 96, "LogRecord has padding");
+
+static uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A record and its waypoints, ptsx then ptsy, laid out as in the file
+struct LogEntry {
+    LogRecord record;
+    double pts[2 * MAX_WAYPOINTS];
+};
+
+static_assert(offsetof(LogEntry, pts) == sizeof(LogRecord), "LogEntry has padding");
+
+// Single producer, single consumer ring of the records of one thread
+struct LogRing {
+    static const size_t SIZE = 512;
+
+    LogEntry entries[SIZE];
+    std::atomic<uint64_t> head;     // written by the thread
+    std::atomic<uint64_t> tail;     // written by the flusher
+
+    LogRing() : head(0), tail(0) {}
+};
+
+// The ring of the calling thread and the writer it belongs to
+static thread_local LogWriter* ring_writer = NULL;
+static thread_local LogRing* ring = NULL;
+
+LogWriter::LogWriter() : file(NULL), start(0), dropped(0), stopping(false) {}
+
+LogWriter::~LogWriter() {
+    Close();
+}
+
+bool LogWriter::Open(const std::string& path) {
+    Close();
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    LogHeader header;
+    header.magic = LOG_MAGIC;
+    header.record_size = sizeof(LogRecord);
+    header.max_waypoints = MAX_WAYPOINTS;
+    fwrite(&header, sizeof(header), 1, file);
+    start = Now();
+    stopping = false;
+    flusher = std::thread(&LogWriter::Flush, this);
+    return true;
+}
+
+void LogWriter::Close() {
+    if (file == NULL) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        stopping = true;
+    }
+    flusher_wake.notify_one();
+    flusher.join();
+    Drain();
+    fclose(file);
+    file = NULL;
+}
+
+uint64_t LogWriter::Dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+// The ring of the calling thread, registered on its first record
+LogRing* LogWriter::ThreadRing() {
+    if (ring_writer != this) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::unique_ptr<LogRing>(new LogRing()));
+        ring = rings.back().get();
+        ring_writer = this;
+    }
+    return ring;
+}
+
+// Flusher: write out the records of every ring. The file is flushed after
+// each pass, so a killed server loses the last few milliseconds at most
+// and the reader stops at a record cut short.
+void LogWriter::Drain() {
+    std::vector<LogRing*> current;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t i = 0; i < rings.size(); i++) {
+            current.push_back(rings[i].get());
+        }
+    }
+    for (size_t i = 0; i < current.size(); i++) {
+        LogRing& r = *current[i];
+        uint64_t head = r.head.load(std::memory_order_acquire);
+        uint64_t tail = r.tail.load(std::memory_order_relaxed);
+        for (; tail != head; tail++) {
+            const LogEntry& entry = r.entries[tail % LogRing::SIZE];
+            fwrite(&entry, entry.record.size, 1, file);
+        }
+        r.tail.store(tail, std::memory_order_release);
+    }
+    fflush(file);
+}
+
+void LogWriter::Flush() {
+    std::unique_lock<std::mutex> lock(flusher_mutex);
+    while (!stopping) {
+        flusher_wake.wait_for(lock, std::chrono::milliseconds(20));
+        Drain();
+    }
+}
+
+void LogWriter::Record(uint32_t session, const Telemetry& telemetry, double steering_angle,
+                       double throttle, double cost, double solve_time, int status,
+                       int iterations, bool fallback) {
+    if (file == NULL) {
+        return;
+    }
+    LogRing* r = ThreadRing();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) >= LogRing::SIZE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    LogEntry& entry = r->entries[head % LogRing::SIZE];
+    LogRecord& record = entry.record;
+    int n = std::min<int>(telemetry.ptsx.size(), MAX_WAYPOINTS);
+    record.size = sizeof(LogRecord) + 2 * n * sizeof(double);
+    record.n_points = n;
+    record.flags = (fallback ? LogRecord::FALLBACK : 0) | (telemetry.binary ? LogRecord::BINARY : 0);
+    record.time = Now() - start;
+    record.session = session;
+    record.status = status;
+    record.iterations = iterations;
+    record.reserved = 0;
+    record.x = telemetry.px;
+    record.y = telemetry.py;
+    record.psi = telemetry.psi;
+    record.speed = telemetry.v;
+    record.steering_angle = steering_angle;
+    record.throttle = throttle;
+    record.cost = cost;
+    record.solve_time = solve_time;
+    memcpy(entry.pts, telemetry.ptsx.data(), n * sizeof(double));
+    memcpy(entry.pts + n, telemetry.ptsy.data(), n * sizeof(double));
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+LogReader::LogReader() : data(NULL), length(0), offset(0) {}
+
+LogReader::~LogReader() {
+    if (data != NULL) {
+        munmap(const_cast<char*>(data), length);
+    }
+}
+
+bool LogReader::Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(LogHeader)) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    data = static_cast<const char*>(map);
+    length = st.st_size;
+    madvise(map, length, MADV_SEQUENTIAL);
+
+    const LogHeader* header = reinterpret_cast<const LogHeader*>(data);
+    if (header->magic != LOG_MAGIC || header->record_size != sizeof(LogRecord) ||
+        header->max_waypoints > MAX_WAYPOINTS) {
+        return false;
+    }
+    offset = sizeof(LogHeader);
+    return true;
+}
+
+bool LogReader::Next(const LogRecord*& record, const double*& ptsx, const double*& ptsy) {
+    // A record cut short by a crash of the writer ends the log
+    if (data == NULL || length - offset < sizeof(LogRecord)) {
+        return false;
+    }
+    record = reinterpret_cast<const LogRecord*>(data + offset);
+    size_t size = sizeof(LogRecord) + 2 * record->n_points * sizeof(double);
+    if (record->size != size || length - offset < size || record->n_points > MAX_WAYPOINTS) {
+        return false;
+    }
+    ptsx = reinterpret_cast<const double*>(data + offset + sizeof(LogRecord));
+    ptsy = ptsx + record->n_points;
+    offset += size;
+    return true;
+}
+
+void LogReader::Rewind() {
+    offset = sizeof(LogHeader);
+}
+
+void LogReader::ToTelemetry(const LogRecord& record, const double* ptsx, const double* ptsy,
+                            Telemetry& telemetry) {
+    telemetry.ptsx = Eigen::Map<const Eigen::VectorXd>(ptsx, record.n_points);
+    telemetry.ptsy = Eigen::Map<const Eigen::VectorXd>(ptsy, record.n_points);
+    telemetry.px = record.x;
+    telemetry.py = record.y;
+    telemetry.psi = record.psi;
+    telemetry.v = record.speed;
+    telemetry.binary = (record.flags & LogRecord::BINARY) != 0;
+    telemetry.sequence = 0;
+}
@@ -0,0 +1,126 @@
+#ifndef TELEMETRY_LOG_H
+#define TELEMETRY_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Telemetry.h"
+
+// Append-only binary log of the telemetry the controller solved for, with
+// the actuations it answered and the solver statistics, to profile and
+// regression test the controller offline with mpc_replay.
+//
+// The file is a LogHeader followed by records. A record is a LogRecord and
+// its waypoints, ptsx[n_points] then ptsy[n_points]. Fields are in the byte
+// order of the machine that wrote the log and every record is a multiple
+// of 8 bytes long, so a mapped log can be read in place.
+
+const uint64_t LOG_MAGIC = 0x3130474f4c43504dULL;   // "MPCLOG01"
+
+struct LogHeader {
+    uint64_t magic;             // LOG_MAGIC
+    uint32_t record_size;       // sizeof(LogRecord)
+    uint32_t max_waypoints;     // MAX_WAYPOINTS
+};
+
+struct LogRecord {
+    enum Flags {
+        FALLBACK = 1,           // the previous plan was used
+        BINARY = 2              // came in a binary frame
+    };
+
+    uint32_t size;              // bytes of the record, waypoints included
+    uint16_t n_points;
+    uint16_t flags;
+    uint64_t time;              // ns since the log was opened
+    uint32_t session;           // connection it came from
+    int32_t status;             // of the solve, MPC::SolveResult::Status
+    int32_t iterations;
+    uint32_t reserved;
+
+    // Telemetry
+    double x;
+    double y;
+    double psi;
+    double speed;
+
+    // Answer
+    double steering_angle;      // in [-1, 1], as sent
+    double throttle;
+    double cost;
+    double solve_time;          // s
+};
+
+struct LogRing;
+
+// Writes a log. Record may be called from several threads: it copies the
+// record into a ring of the calling thread, which no other thread writes,
+// and a background thread drains the rings into the file every few
+// milliseconds, so recording takes no lock and makes no system call on the
+// solve threads. A ring that is full drops its records, counted in Dropped.
+class LogWriter {
+public:
+    LogWriter();
+    virtual ~LogWriter();
+
+    bool Open(const std::string& path);
+
+    // Drain the rings and close the file
+    void Close();
+
+    void Record(uint32_t session, const Telemetry& telemetry, double steering_angle,
+                double throttle, double cost, double solve_time, int status, int iterations,
+                bool fallback);
+
+    // Records lost to full rings
+    uint64_t Dropped() const;
+
+private:
+    FILE* file;
+    uint64_t start;             // steady clock ns
+    std::mutex rings_mutex;
+    std::vector<std::unique_ptr<LogRing> > rings;   // kept with the writer
+    std::atomic<uint64_t> dropped;
+    std::thread flusher;
+    std::mutex flusher_mutex;
+    std::condition_variable flusher_wake;
+    bool stopping;
+
+    LogRing* ThreadRing();
+    void Drain();
+    void Flush();
+};
+
+// Maps a log and walks its records in place
+class LogReader {
+public:
+    LogReader();
+    virtual ~LogReader();
+
+    // False if the file cannot be mapped or is not a log
+    bool Open(const std::string& path);
+
+    // The next whole record and its waypoints, false at the end
+    bool Next(const LogRecord*& record, const double*& ptsx, const double*& ptsy);
+
+    // Back to the first record
+    void Rewind();
+
+    // The telemetry of `record`
+    static void ToTelemetry(const LogRecord& record, const double* ptsx, const double* ptsy,
+                            Telemetry& telemetry);
+
+private:
+    const char* data;
+    size_t length;
+    size_t offset;
+};
+
+#endif /* TELEMETRY_LOG_H */
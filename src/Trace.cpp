@@ -0,0 +1,181 @@
+#include "Trace.h"
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Profile.h"
+
+namespace {
+
+struct Event {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// Single producer, single consumer ring of events of one thread
+struct Ring {
+    static const size_t SIZE = 1 << 14;
+
+    Event events[SIZE];
+    std::atomic<uint64_t> head;     // written by the thread
+    std::atomic<uint64_t> tail;     // written by the flusher
+    std::atomic<const char*> name;
+    uint32_t tid;
+    bool named;                     // flusher only, the name was written
+
+    explicit Ring(uint32_t tid) : head(0), tail(0), name(NULL), tid(tid), named(false) {}
+};
+
+// The rings of every thread that traced, kept until the process ends so a
+// thread may exit with events not yet flushed
+std::mutex rings_mutex;
+std::vector<std::unique_ptr<Ring> > rings;
+
+thread_local Ring* ring = NULL;
+thread_local const char* thread_name = NULL;
+
+std::atomic<uint64_t> dropped(0);
+
+FILE* file = NULL;
+bool first = true;                  // no event written yet
+uint64_t epoch = 0;                 // Profile::Now at Start
+std::thread flusher;
+std::mutex flusher_mutex;
+std::condition_variable flusher_wake;
+bool stopping = false;
+
+// The ring of the calling thread, registered on its first event
+Ring* ThreadRing() {
+    if (ring == NULL) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::unique_ptr<Ring>(new Ring(uint32_t(rings.size() + 1))));
+        ring = rings.back().get();
+        ring->name.store(thread_name, std::memory_order_release);
+    }
+    return ring;
+}
+
+void Write(const char* text) {
+    fprintf(file, "%s%s", first ? "[\n" : ",\n", text);
+    first = false;
+}
+
+// Flusher: write out the events of every ring
+void Drain() {
+    std::vector<Ring*> current;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t i = 0; i < rings.size(); i++) {
+            current.push_back(rings[i].get());
+        }
+    }
+    char line[256];
+    for (size_t i = 0; i < current.size(); i++) {
+        Ring& r = *current[i];
+        const char* name = r.name.load(std::memory_order_acquire);
+        if (!r.named && name != NULL) {
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"name\":\"%s\"}}", r.tid, name);
+            Write(line);
+            r.named = true;
+        }
+        uint64_t head = r.head.load(std::memory_order_acquire);
+        uint64_t tail = r.tail.load(std::memory_order_relaxed);
+        for (; tail != head; tail++) {
+            const Event& e = r.events[tail % Ring::SIZE];
+            // Events from before Start are left out
+            if (e.begin >= epoch) {
+                snprintf(line, sizeof(line),
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                         "\"ts\":%.3f,\"dur\":%.3f}", e.name, r.tid,
+                         1e-3 * (e.begin - epoch), 1e-3 * (e.end - e.begin));
+                Write(line);
+            }
+        }
+        r.tail.store(tail, std::memory_order_release);
+    }
+    fflush(file);
+}
+
+void Flush() {
+    std::unique_lock<std::mutex> lock(flusher_mutex);
+    while (!stopping) {
+        flusher_wake.wait_for(lock, std::chrono::milliseconds(20));
+        Drain();
+    }
+}
+
+}
+
+std::atomic<bool> Trace::enabled(false);
+
+bool Trace::Start(const std::string& path) {
+    if (file != NULL) {
+        return false;
+    }
+    file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+        return false;
+    }
+    first = true;
+    epoch = Profile::Now();
+    stopping = false;
+    flusher = std::thread(Flush);
+    enabled.store(true);
+    return true;
+}
+
+void Trace::Stop() {
+    if (file == NULL) {
+        return;
+    }
+    enabled.store(false);
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        stopping = true;
+    }
+    flusher_wake.notify_one();
+    flusher.join();
+    Drain();
+    fprintf(file, first ? "[]\n" : "\n]\n");
+    fclose(file);
+    file = NULL;
+}
+
+void Trace::Thread(const char* name) {
+    thread_name = name;
+    if (ring != NULL) {
+        ring->name.store(name, std::memory_order_release);
+    }
+}
+
+uint64_t Trace::Dropped() {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+void Trace::Record(const char* name, uint64_t begin, uint64_t end) {
+    Ring* r = ThreadRing();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) >= Ring::SIZE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& e = r->events[head % Ring::SIZE];
+    e.name = name;
+    e.begin = begin;
+    e.end = end;
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+Trace::Scope::Scope(const char* name) : name(name), begin(Enabled() ? Profile::Now() : 0) {}
+
+Trace::Scope::~Scope() {
+    if (begin != 0) {
+        Record(name, begin, Profile::Now());
+    }
+}
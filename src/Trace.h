@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// Opt-in timeline of the ticks in the Chrome trace event format, for
+// chrome://tracing or ui.perfetto.dev (see --trace).
+//
+// Every stage timed by Profile, every Ipopt iteration and function
+// evaluation and every tick of a solve task becomes a complete event, its
+// begin time and duration, on the thread it ran on. Events go into a ring
+// buffer of the thread, which no other thread writes, and a background
+// thread drains the rings into the file every few milliseconds, so tracing
+// takes no lock and makes no system call on the hot path. A ring that is
+// full drops its events, counted in Dropped.
+//
+// When tracing is off an event costs one relaxed atomic load.
+
+struct Trace {
+    // Start writing the trace to `path`
+    static bool Start(const std::string& path);
+
+    // Drain the rings, close the json array and the file
+    static void Stop();
+
+    static bool Enabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Name the calling thread in the trace
+    static void Thread(const char* name);
+
+    // An event `name` (a string literal, kept by pointer) from `begin` to
+    // `end`, Profile::Now times
+    static void Complete(const char* name, uint64_t begin, uint64_t end) {
+        if (Enabled()) {
+            Record(name, begin, end);
+        }
+    }
+
+    // Events lost to full rings
+    static uint64_t Dropped();
+
+    // An event for its scope
+    class Scope {
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+    private:
+        const char* name;
+        uint64_t begin;
+    };
+
+private:
+    static std::atomic<bool> enabled;
+
+    static void Record(const char* name, uint64_t begin, uint64_t end);
+};
+
+#endif /* TRACE_H */
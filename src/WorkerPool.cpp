@@ -0,0 +1,117 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(size_t n_workers, const std::function<void(size_t)>& start)
+    : stealable(0), stolen(0), stop(false), start(start) {
+    if (n_workers == 0) {
+        n_workers = 1;
+    }
+    for (size_t i = 0; i < n_workers; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (size_t i = 0; i < n_workers; i++) {
+        workers[i]->thread = std::thread(&WorkerPool::Run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread.join();
+    }
+}
+
+void WorkerPool::Submit(const Task& task, size_t worker, bool pinned) {
+    Worker& w = *workers[worker % workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(Queued());
+        w.tasks.back().task = task;
+        w.tasks.back().pinned = pinned;
+        w.queued.fetch_add(1);
+    }
+    if (!pinned) {
+        stealable.fetch_add(1);
+    }
+
+    // Taking the lock orders the submit with a worker going to sleep, so
+    // the wake up is not lost. Any worker may take an unpinned task; a
+    // pinned one needs its own worker, which may not be the one woken.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    if (pinned) {
+        wake.notify_all();
+    } else {
+        wake.notify_one();
+    }
+}
+
+size_t WorkerPool::Size() const {
+    return workers.size();
+}
+
+size_t WorkerPool::Stolen() const {
+    return stolen.load();
+}
+
+// The oldest task of worker `index`, or else the newest unpinned one of
+// another worker
+
+bool WorkerPool::Take(size_t index, Task& task) {
+    {
+        Worker& w = *workers[index];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            if (!w.tasks.front().pinned) {
+                stealable.fetch_sub(1);
+            }
+            task.swap(w.tasks.front().task);
+            w.tasks.pop_front();
+            w.queued.fetch_sub(1);
+            return true;
+        }
+    }
+    for (size_t k = 1; k < workers.size(); k++) {
+        Worker& w = *workers[(index + k) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        for (std::deque<Queued>::iterator it = w.tasks.end(); it != w.tasks.begin();) {
+            --it;
+            if (!it->pinned) {
+                task.swap(it->task);
+                w.tasks.erase(it);
+                w.queued.fetch_sub(1);
+                stealable.fetch_sub(1);
+                stolen.fetch_add(1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void WorkerPool::Run(size_t index) {
+    if (start) {
+        start(index);
+    }
+    Task task;
+    for (;;) {
+        if (Take(index, task)) {
+            task();
+            task = Task();
+            continue;
+        }
+        // Sleep until there is a task this worker may take
+        Worker& w = *workers[index];
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this, &w] {
+            return stop || w.queued.load() > 0 || stealable.load() > 0;
+        });
+        if (stop && w.queued.load() == 0 && stealable.load() == 0) {
+            return;
+        }
+    }
+}
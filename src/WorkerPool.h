@@ -0,0 +1,70 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of threads running tasks, with work stealing.
+//
+// Each worker has its own queue. Submit puts a task on the queue of the
+// worker it names, so the tasks of one client tend to run on the same core,
+// and a worker runs its tasks in the order they came. A worker with nothing
+// to do steals the newest task of another, the one that would wait the
+// longest, before going to sleep. Pinned tasks are never stolen, for state
+// that has to stay on one thread.
+
+class WorkerPool {
+public:
+    typedef std::function<void()> Task;
+
+    // Each worker calls `start` with its index before its first task
+    explicit WorkerPool(size_t n_workers,
+                        const std::function<void(size_t)>& start = std::function<void(size_t)>());
+
+    // Runs the queued tasks, then joins the workers
+    virtual ~WorkerPool();
+
+    // Queue `task` on worker `worker` modulo Size(). A pinned task runs on
+    // that worker.
+    void Submit(const Task& task, size_t worker, bool pinned = false);
+
+    size_t Size() const;
+
+    // Tasks run by a worker other than the one they were submitted to
+    size_t Stolen() const;
+
+private:
+    struct Queued {
+        Task task;
+        bool pinned;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Queued> tasks;
+        std::atomic<size_t> queued;     // tasks.size(), read without the mutex
+        std::thread thread;
+
+        Worker() : queued(0) {}
+    };
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::atomic<size_t> stealable;  // unpinned tasks queued, not yet taken
+    std::atomic<size_t> stolen;
+    std::mutex mutex;               // only to sleep and wake
+    std::condition_variable wake;
+    bool stop;
+    std::function<void(size_t)> start;
+
+    void Run(size_t index);
+    bool Take(size_t index, Task& task);
+};
+
+#endif /* WORKER_POOL_H */
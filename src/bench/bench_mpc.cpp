@@ -0,0 +1,259 @@
+// Benchmarks MPC::Solve on a fixed corpus of states and roads, so that
+// configurations can be compared with each other and across commits.
+//
+// Usage: bench_mpc [controller options] [--N=<n>] [--dt=<s>] [--order=<k>]
+//                  [--log=<file>] [--warmup=<n>] [--passes=<n>] [--json=<file>]
+//                  [--label=<text>] [--counters]
+//
+// The corpus is a set of synthetic ticks, smooth sequences over roads from
+// straight to sharp bends, followed by the telemetry of a log recorded with
+// `mpc --record` when --log is given. The ticks are solved in order, as a
+// controller would see them, after `warmup` solves that are not measured.
+// It prints the percentiles of the solve latency, the solver iterations
+// and the heap allocations per tick (Solve and Prepare, but not Ipopt's
+// own code), and the time of the stages of the solver (see Profile.h,
+// warm-up included), with --counters their hardware counters, and with
+// --json appends them as one line of json to the file.
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "AllocationCounter.h"
+#include "Driver.h"
+#include "Profile.h"
+#include "TelemetryLog.h"
+#include "json.hpp"
+
+using Eigen::BenchTimer;
+using json = nlohmann::json;
+
+// Highest order of polynomial the corpus holds
+static const int MAX_ORDER = 7;
+
+// One tick: the state of the car and the fitted road
+struct Sample {
+    double state[6];
+    double coeffs[MAX_ORDER + 1];
+};
+
+struct Results {
+    std::vector<double> latency;    // s
+    std::vector<double> iterations;
+    std::vector<double> allocations;
+    size_t fallbacks;
+};
+
+static void Synthetic(std::vector<Sample>& corpus) {
+    const double bends[][2] = {{0.0, 0.0}, {0.002, 1e-5}, {-0.006, -5e-5}, {0.01, 1e-4}};
+    for (int b = 0; b < 4; b++) {
+        for (int k = 0; k < 50; k++) {
+            Sample sample = Sample();
+            double cte = sin(0.2 * k);
+            double epsi = 0.1 * cos(0.15 * k);
+            double v = 30.0 + 10.0 * (1.0 + sin(0.05 * k));
+            double state[] = {0.0, 0.0, 0.0, v, cte, epsi};
+            std::copy(state, state + 6, sample.state);
+            sample.coeffs[0] = cte;
+            sample.coeffs[1] = tan(epsi);
+            sample.coeffs[2] = bends[b][0];
+            sample.coeffs[3] = bends[b][1];
+            corpus.push_back(sample);
+        }
+    }
+}
+
+static bool Recorded(const std::string& path, std::vector<Sample>& corpus) {
+    LogReader reader;
+    if (!reader.Open(path)) {
+        return false;
+    }
+    const LogRecord* record;
+    const double* ptsx;
+    const double* ptsy;
+    Telemetry telemetry;
+    Road road;
+    Controller::State state;
+    while (reader.Next(record, ptsx, ptsy)) {
+        LogReader::ToTelemetry(*record, ptsx, ptsy, telemetry);
+        Fit(telemetry, road, state);
+        Sample sample = Sample();
+        std::copy(state.data(), state.data() + 6, sample.state);
+        std::copy(road.coeffs.data(), road.coeffs.data() + road.coeffs.size(), sample.coeffs);
+        corpus.push_back(sample);
+    }
+    return true;
+}
+
+template <class M>
+static void Run(const MPCConfig& config, const Options& options,
+                const std::vector<Sample>& corpus, int warmup, int passes, Results& results) {
+    M mpc(config);
+    options.Apply(mpc);
+
+    typename M::State state;
+    typename M::Coeffs coeffs = M::Coeffs::Zero(config.order + 1);
+    BenchTimer timer;
+    size_t ticks = warmup + passes * corpus.size();
+    for (size_t k = 0; k < ticks; k++) {
+        const Sample& sample = corpus[k % corpus.size()];
+        for (int i = 0; i < 6; i++) {
+            state[i] = sample.state[i];
+        }
+        for (int i = 0; i <= config.order; i++) {
+            coeffs[i] = sample.coeffs[i];
+        }
+
+        AllocationCounter::Start();
+        timer.start();
+        typename M::SolveResult result = mpc.Solve(state, coeffs);
+        timer.stop();
+        mpc.Prepare();
+        size_t allocations = AllocationCounter::Stop();
+
+        if (k >= size_t(warmup)) {
+            results.latency.push_back(timer.value(Eigen::REAL_TIMER));
+            results.iterations.push_back(result.iterations);
+            results.allocations.push_back(allocations);
+            results.fallbacks += result.fallback;
+        }
+    }
+}
+
+static double Percentile(std::vector<double> values, double p) {
+    size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+static double Mean(const std::vector<double>& values) {
+    double sum = 0.0;
+    for (size_t i = 0; i < values.size(); i++) {
+        sum += values[i];
+    }
+    return sum / values.size();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    MPCConfig config;
+    std::string log;
+    std::string output;
+    std::string label;
+    int warmup = 20;
+    int passes = 5;
+    bool counters = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (options.Parse(arg)) {
+            continue;
+        } else if (arg.compare(0, 4, "--N=") == 0) {
+            config.N = atoi(arg.c_str() + 4);
+        } else if (arg.compare(0, 5, "--dt=") == 0) {
+            config.dt = atof(arg.c_str() + 5);
+        } else if (arg.compare(0, 8, "--order=") == 0) {
+            config.order = atoi(arg.c_str() + 8);
+        } else if (arg.compare(0, 6, "--log=") == 0) {
+            log = arg.substr(6);
+        } else if (arg.compare(0, 9, "--warmup=") == 0) {
+            warmup = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 9, "--passes=") == 0) {
+            passes = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 7, "--json=") == 0) {
+            output = arg.substr(7);
+        } else if (arg.compare(0, 8, "--label=") == 0) {
+            label = arg.substr(8);
+        } else if (arg == "--counters") {
+            counters = true;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (config.N < 3 || config.order < 1 || config.order > MAX_ORDER || passes < 1) {
+        std::cerr << "Need N >= 3, 1 <= order <= " << MAX_ORDER << " and passes >= 1" << std::endl;
+        return -1;
+    }
+
+    if (counters && !PerfCounters::Enable()) {
+        std::cerr << "Cannot open the hardware counters, see perf_event_paranoid" << std::endl;
+        return -1;
+    }
+
+    std::vector<Sample> corpus;
+    Synthetic(corpus);
+    size_t synthetic = corpus.size();
+    if (!log.empty()) {
+        // The log is fitted with the server's polynomial
+        if (config.order != 3 || !Recorded(log, corpus)) {
+            std::cerr << "Cannot use the log " << log << " (it needs --order=3)" << std::endl;
+            return -1;
+        }
+    }
+
+    // The server's configuration runs with the offsets known at compile time
+    Results results;
+    results.fallbacks = 0;
+    if (config.N == 15 && config.order == 3) {
+        Run<Controller>(config, options, corpus, warmup, passes, results);
+    } else {
+        Run<MPC<Eigen::Dynamic, Eigen::Dynamic> >(config, options, corpus, warmup, passes,
+                                                   results);
+    }
+
+    const char* backends[] = {"ipopt", "rti", "compare"};
+    const char* kkts[] = {"condensed", "riccati"};
+    const char* derivatives[] = {"tape", "analytic", "generated"};
+
+    json report;
+    report["label"] = label;
+    report["N"] = config.N;
+    report["dt"] = config.dt;
+    report["order"] = config.order;
+    report["backend"] = backends[options.backend];
+    report["kkt"] = kkts[options.kkt];
+    report["derivatives"] = derivatives[options.derivatives];
+    report["warm_start"] = options.warm_start;
+    report["deadline_ms"] = 1000.0 * options.deadline;
+    report["corpus"] = {{"synthetic", synthetic}, {"recorded", corpus.size() - synthetic}};
+    report["solves"] = results.latency.size();
+    report["latency_ms"] = {{"mean", 1000.0 * Mean(results.latency)},
+                            {"p50", 1000.0 * Percentile(results.latency, 0.5)},
+                            {"p90", 1000.0 * Percentile(results.latency, 0.9)},
+                            {"p99", 1000.0 * Percentile(results.latency, 0.99)},
+                            {"max", 1000.0 * Percentile(results.latency, 1.0)}};
+    report["iterations"] = {{"mean", Mean(results.iterations)},
+                            {"max", Percentile(results.iterations, 1.0)}};
+    report["allocations"] = {{"mean", Mean(results.allocations)},
+                             {"max", Percentile(results.allocations, 1.0)}};
+    report["fallbacks"] = results.fallbacks;
+    for (int i = 0; i < Profile::STAGES; i++) {
+        const Histogram& h = Profile::Get(Profile::Stage(i));
+        if (h.Count() > 0) {
+            report["stages_us"][Profile::Name(Profile::Stage(i))] = {
+                {"p50", 1e-3 * h.Percentile(0.5)}, {"p99", 1e-3 * h.Percentile(0.99)},
+                {"max", 1e-3 * h.Max()}};
+        }
+        // Per run of the stage
+        for (int c = 0; counters && h.Count() > 0 && c < PerfCounters::COUNTERS; c++) {
+            PerfCounters::Counter counter = PerfCounters::Counter(c);
+            report["stage_counters"][Profile::Name(Profile::Stage(i))][PerfCounters::Name(counter)] =
+                double(Profile::Counter(Profile::Stage(i), counter)) / h.Count();
+        }
+    }
+
+    std::cout << report.dump(2) << std::endl;
+    if (!output.empty()) {
+        std::ofstream out(output.c_str(), std::ios::app);
+        out << report.dump() << std::endl;
+        if (!out) {
+            std::cerr << "Cannot write " << output << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+#ifndef SYM_H
+#define SYM_H
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Minimal symbolic scalar for the code generator.
+//
+// Evaluating the model templates in MPC_Model.h with Sym records an
+// expression graph instead of a tape. Equal subexpressions are shared and
+// constants are folded as the graph is built, so the derivatives taken on
+// it and the straight-line code emitted from it stay small.
+
+namespace sym {
+
+enum Op { CONST, VAR, PARAM, WEIGHT, ADD, SUB, MUL, DIV, NEG, SIN, COS, ATAN };
+
+struct Node {
+    Op op;
+    int a;
+    int b;
+    double value;   // CONST
+    int index;      // VAR, PARAM and WEIGHT
+};
+
+class Graph {
+public:
+    std::vector<Node> nodes;
+
+    static Graph& Get() {
+        static Graph graph;
+        return graph;
+    }
+
+    int Constant(double value) {
+        return Add(CONST, -1, -1, value, 0);
+    }
+
+    int Leaf(Op op, int index) {
+        return Add(op, -1, -1, 0.0, index);
+    }
+
+    bool IsConstant(int n, double value) const {
+        return nodes[n].op == CONST && nodes[n].value == value;
+    }
+
+    int Unary(Op op, int a) {
+        if (nodes[a].op == CONST) {
+            double x = nodes[a].value;
+            switch (op) {
+                case NEG: return Constant(-x);
+                case SIN: return Constant(sin(x));
+                case COS: return Constant(cos(x));
+                case ATAN: return Constant(atan(x));
+                default: break;
+            }
+        }
+        if (op == NEG && nodes[a].op == NEG) {
+            return nodes[a].a;
+        }
+        return Add(op, a, -1, 0.0, 0);
+    }
+
+    int Binary(Op op, int a, int b) {
+        if (nodes[a].op == CONST && nodes[b].op == CONST) {
+            double x = nodes[a].value;
+            double y = nodes[b].value;
+            switch (op) {
+                case ADD: return Constant(x + y);
+                case SUB: return Constant(x - y);
+                case MUL: return Constant(x * y);
+                case DIV: return Constant(x / y);
+                default: break;
+            }
+        }
+        switch (op) {
+            case ADD:
+                if (IsConstant(a, 0.0)) return b;
+                if (IsConstant(b, 0.0)) return a;
+                if (nodes[b].op == NEG) return Binary(SUB, a, nodes[b].a);
+                if (nodes[a].op == NEG) return Binary(SUB, b, nodes[a].a);
+                break;
+            case SUB:
+                if (IsConstant(b, 0.0)) return a;
+                if (IsConstant(a, 0.0)) return Unary(NEG, b);
+                if (a == b) return Constant(0.0);
+                if (nodes[b].op == NEG) return Binary(ADD, a, nodes[b].a);
+                break;
+            case MUL:
+                if (IsConstant(a, 0.0) || IsConstant(b, 0.0)) return Constant(0.0);
+                if (IsConstant(a, 1.0)) return b;
+                if (IsConstant(b, 1.0)) return a;
+                if (IsConstant(a, -1.0)) return Unary(NEG, b);
+                if (IsConstant(b, -1.0)) return Unary(NEG, a);
+                break;
+            case DIV:
+                if (IsConstant(a, 0.0)) return Constant(0.0);
+                if (IsConstant(b, 1.0)) return a;
+                break;
+            default:
+                break;
+        }
+        // Commutative operations are stored in a canonical order so they
+        // are shared
+        if ((op == ADD || op == MUL) && a > b) {
+            std::swap(a, b);
+        }
+        return Add(op, a, b, 0.0, 0);
+    }
+
+    // Derivative of node n with respect to VAR `var`
+    int Derivative(int n, int var) {
+        std::pair<int, int> key(n, var);
+        std::map<std::pair<int, int>, int>::iterator it = derivatives.find(key);
+        if (it != derivatives.end()) {
+            return it->second;
+        }
+
+        const Node node = nodes[n];
+        int d;
+        switch (node.op) {
+            case VAR:
+                d = Constant(node.index == var ? 1.0 : 0.0);
+                break;
+            case ADD:
+                d = Binary(ADD, Derivative(node.a, var), Derivative(node.b, var));
+                break;
+            case SUB:
+                d = Binary(SUB, Derivative(node.a, var), Derivative(node.b, var));
+                break;
+            case MUL:
+                d = Binary(ADD, Binary(MUL, Derivative(node.a, var), node.b),
+                           Binary(MUL, node.a, Derivative(node.b, var)));
+                break;
+            case DIV:
+                // (a' - (a / b) b') / b
+                d = Binary(DIV, Binary(SUB, Derivative(node.a, var),
+                                       Binary(MUL, n, Derivative(node.b, var))), node.b);
+                break;
+            case NEG:
+                d = Unary(NEG, Derivative(node.a, var));
+                break;
+            case SIN:
+                d = Binary(MUL, Unary(COS, node.a), Derivative(node.a, var));
+                break;
+            case COS:
+                d = Unary(NEG, Binary(MUL, Unary(SIN, node.a), Derivative(node.a, var)));
+                break;
+            case ATAN:
+                d = Binary(DIV, Derivative(node.a, var),
+                           Binary(ADD, Constant(1.0), Binary(MUL, node.a, node.a)));
+                break;
+            default:
+                d = Constant(0.0);
+        }
+        derivatives[key] = d;
+        return d;
+    }
+
+    // Write straight-line code assigning outputs[i] to targets[i]. Nodes
+    // used by several outputs are computed once.
+    void Emit(std::ostream& out, const std::vector<int>& outputs,
+              const std::vector<std::string>& targets) {
+        std::vector<bool> used(nodes.size(), false);
+        std::vector<int> stack(outputs.begin(), outputs.end());
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            if (used[n]) {
+                continue;
+            }
+            used[n] = true;
+            if (nodes[n].a >= 0) {
+                stack.push_back(nodes[n].a);
+            }
+            if (nodes[n].b >= 0) {
+                stack.push_back(nodes[n].b);
+            }
+        }
+
+        // Children are always created before their parents
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (used[n] && nodes[n].a >= 0) {
+                out << "    const double t" << n << " = " << Expression(n) << ";\n";
+            }
+        }
+        for (size_t i = 0; i < outputs.size(); i++) {
+            out << "    " << targets[i] << " = " << Name(outputs[i]) << ";\n";
+        }
+    }
+
+private:
+    std::map<std::vector<double>, int> cache;
+    std::map<std::pair<int, int>, int> derivatives;
+
+    int Add(Op op, int a, int b, double value, int index) {
+        std::vector<double> key(5);
+        key[0] = op;
+        key[1] = a;
+        key[2] = b;
+        key[3] = value;
+        key[4] = index;
+        std::map<std::vector<double>, int>::iterator it = cache.find(key);
+        if (it != cache.end()) {
+            return it->second;
+        }
+        Node node = {op, a, b, value, index};
+        nodes.push_back(node);
+        cache[key] = nodes.size() - 1;
+        return nodes.size() - 1;
+    }
+
+    std::string Name(int n) const {
+        const Node& node = nodes[n];
+        char buf[64];
+        switch (node.op) {
+            case CONST: {
+                snprintf(buf, sizeof(buf), "%.17g", node.value);
+                std::string s = buf;
+                if (s.find_first_of(".eni") == std::string::npos) {
+                    s += ".0";
+                }
+                return node.value < 0 ? "(" + s + ")" : s;
+            }
+            case VAR:
+                snprintf(buf, sizeof(buf), "in[%d]", node.index);
+                return buf;
+            case PARAM:
+                snprintf(buf, sizeof(buf), "par[%d]", node.index);
+                return buf;
+            case WEIGHT:
+                snprintf(buf, sizeof(buf), "w[%d]", node.index);
+                return buf;
+            default:
+                snprintf(buf, sizeof(buf), "t%d", n);
+                return buf;
+        }
+    }
+
+    std::string Expression(int n) const {
+        const Node& node = nodes[n];
+        switch (node.op) {
+            case ADD: return Name(node.a) + " + " + Name(node.b);
+            case SUB: return Name(node.a) + " - " + Name(node.b);
+            case MUL: return Name(node.a) + " * " + Name(node.b);
+            case DIV: return Name(node.a) + " / " + Name(node.b);
+            case NEG: return "-" + Name(node.a);
+            case SIN: return "sin(" + Name(node.a) + ")";
+            case COS: return "cos(" + Name(node.a) + ")";
+            case ATAN: return "atan(" + Name(node.a) + ")";
+            default: return Name(n);
+        }
+    }
+};
+
+// Scalar recording into the graph
+struct Sym {
+    int id;
+
+    Sym() : id(Graph::Get().Constant(0.0)) {}
+    Sym(double value) : id(Graph::Get().Constant(value)) {}
+
+    static Sym Node(int id) {
+        Sym s;
+        s.id = id;
+        return s;
+    }
+
+    static Sym Var(int index) { return Node(Graph::Get().Leaf(VAR, index)); }
+    static Sym Param(int index) { return Node(Graph::Get().Leaf(PARAM, index)); }
+    static Sym Weight(int index) { return Node(Graph::Get().Leaf(WEIGHT, index)); }
+
+    Sym& operator+=(const Sym& b) {
+        id = Graph::Get().Binary(ADD, id, b.id);
+        return *this;
+    }
+};
+
+inline Sym operator+(const Sym& a, const Sym& b) { return Sym::Node(Graph::Get().Binary(ADD, a.id, b.id)); }
+inline Sym operator-(const Sym& a, const Sym& b) { return Sym::Node(Graph::Get().Binary(SUB, a.id, b.id)); }
+inline Sym operator*(const Sym& a, const Sym& b) { return Sym::Node(Graph::Get().Binary(MUL, a.id, b.id)); }
+inline Sym operator/(const Sym& a, const Sym& b) { return Sym::Node(Graph::Get().Binary(DIV, a.id, b.id)); }
+inline Sym operator-(const Sym& a) { return Sym::Node(Graph::Get().Unary(NEG, a.id)); }
+inline Sym sin(const Sym& a) { return Sym::Node(Graph::Get().Unary(SIN, a.id)); }
+inline Sym cos(const Sym& a) { return Sym::Node(Graph::Get().Unary(COS, a.id)); }
+inline Sym atan(const Sym& a) { return Sym::Node(Graph::Get().Unary(ATAN, a.id)); }
+
+inline Sym Derivative(const Sym& a, int var) {
+    return Sym::Node(Graph::Get().Derivative(a.id, var));
+}
+
+inline bool IsZero(const Sym& a) {
+    return Graph::Get().IsConstant(a.id, 0.0);
+}
+
+}  // namespace sym
+
+#endif /* SYM_H */
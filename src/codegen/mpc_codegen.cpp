@@ -0,0 +1,168 @@
+// Writes the kernels declared in MPC_Kernel.h.
+//
+// The model templates of MPC_Model.h are evaluated with sym::Sym, then the
+// value, the Jacobian and the Hessian of each kernel are differentiated on
+// the expression graph and emitted as straight-line C++.
+//
+// Usage: mpc_codegen <output.cpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "Sym.h"
+#include "MPC_Kernel.h"
+#include "MPC_Model.h"
+
+using sym::Sym;
+
+static void Array(std::ostream& out, const std::string& name, const std::vector<int>& values) {
+    out << "static const int " << name << "[] = {";
+    for (size_t i = 0; i < values.size(); i++) {
+        out << (i ? ", " : "") << values[i];
+    }
+    // Arrays can not be empty
+    if (values.empty()) {
+        out << "0";
+    }
+    out << "};\n";
+}
+
+static std::string Target(const char* name, size_t i) {
+    std::ostringstream s;
+    s << name << "[" << i << "]";
+    return s.str();
+}
+
+static void Kernel(std::ostream& out, const std::string& name, int n_in,
+                   const std::vector<Sym>& outputs) {
+    sym::Graph& graph = sym::Graph::Get();
+    std::vector<int> ids;
+    std::vector<std::string> targets;
+
+    out << "// " << name << "\n\n";
+    out << "static void " << name << "_eval(const double* in, const double* par, double* out) {\n";
+    for (size_t i = 0; i < outputs.size(); i++) {
+        ids.push_back(outputs[i].id);
+        targets.push_back(Target("out", i));
+    }
+    graph.Emit(out, ids, targets);
+    out << "}\n\n";
+
+    // Jacobian, structurally zero entries dropped
+    std::vector<int> jac_row, jac_col;
+    ids.clear();
+    targets.clear();
+    for (size_t i = 0; i < outputs.size(); i++) {
+        for (int j = 0; j < n_in; j++) {
+            Sym d = sym::Derivative(outputs[i], j);
+            if (!sym::IsZero(d)) {
+                jac_row.push_back(i);
+                jac_col.push_back(j);
+                ids.push_back(d.id);
+                targets.push_back(Target("values", ids.size() - 1));
+            }
+        }
+    }
+    out << "static void " << name << "_jac(const double* in, const double* par, double* values) {\n";
+    graph.Emit(out, ids, targets);
+    out << "}\n\n";
+
+    // Hessian of the weighted sum of the outputs, lower triangle
+    Sym lagrangian = 0.0;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        lagrangian += Sym::Weight(i) * outputs[i];
+    }
+    std::vector<int> hes_row, hes_col;
+    ids.clear();
+    targets.clear();
+    for (int j = 0; j < n_in; j++) {
+        Sym dj = sym::Derivative(lagrangian, j);
+        for (int k = 0; k <= j; k++) {
+            Sym d = sym::Derivative(dj, k);
+            if (!sym::IsZero(d)) {
+                hes_row.push_back(j);
+                hes_col.push_back(k);
+                ids.push_back(d.id);
+                targets.push_back(Target("values", ids.size() - 1));
+            }
+        }
+    }
+    out << "static void " << name << "_hes(const double* in, const double* par, const double* w, "
+        << "double* values) {\n";
+    graph.Emit(out, ids, targets);
+    out << "}\n\n";
+
+    Array(out, name + "_jac_row", jac_row);
+    Array(out, name + "_jac_col", jac_col);
+    Array(out, name + "_hes_row", hes_row);
+    Array(out, name + "_hes_col", hes_col);
+    out << "\nconst MPC_Kernel kernel_" << name << " = {\n"
+        << "    " << n_in << ", " << outputs.size() << ",\n"
+        << "    " << jac_row.size() << ", " << name << "_jac_row, " << name << "_jac_col,\n"
+        << "    " << hes_row.size() << ", " << name << "_hes_row, " << name << "_hes_col,\n"
+        << "    " << name << "_eval, " << name << "_jac, " << name << "_hes};\n\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: mpc_codegen <output.cpp>" << std::endl;
+        return -1;
+    }
+
+    Sym coeffs[KERNEL_ORDER + 1];
+    for (int i = 0; i <= KERNEL_ORDER; i++) {
+        coeffs[i] = Sym::Param(KERNEL_COEFFS + i);
+    }
+    Sym ref_v = Sym::Param(KERNEL_REF_V);
+    Sym dt = Sym::Param(KERNEL_DT);
+    Sym Lf = Sym::Param(KERNEL_LF);
+    Sym w_delta = Sym::Param(KERNEL_W_DELTA);
+    Sym w_ddelta = Sym::Param(KERNEL_W_DDELTA);
+
+    // Inputs are ordered as their variables in the Ipopt problem, so the
+    // lower triangle of a kernel Hessian is in the lower triangle of the
+    // problem Hessian.
+    std::ostringstream code;
+
+    Sym s0[Model::N_STATE], s1[Model::N_STATE], u0[Model::N_ACTUATION], u1[Model::N_ACTUATION];
+    for (int i = 0; i < Model::N_STATE; i++) {
+        s0[i] = Sym::Var(2 * i);
+        s1[i] = Sym::Var(2 * i + 1);
+    }
+    u0[Model::DELTA] = Sym::Var(2 * Model::N_STATE);
+    u0[Model::A] = Sym::Var(2 * Model::N_STATE + 1);
+    Sym g[Model::N_STATE];
+    Model::Step(s0, u0, s1, coeffs, KERNEL_ORDER, dt, Lf, g);
+    Kernel(code, "step", 2 * Model::N_STATE + Model::N_ACTUATION,
+           std::vector<Sym>(g, g + Model::N_STATE));
+
+    for (int i = 0; i < Model::N_STATE; i++) {
+        s0[i] = Sym::Var(i);
+    }
+    Kernel(code, "state_cost", Model::N_STATE,
+           std::vector<Sym>(1, Model::StateCost(s0, ref_v)));
+
+    u0[Model::DELTA] = Sym::Var(0);
+    u0[Model::A] = Sym::Var(1);
+    Kernel(code, "actuation_cost", Model::N_ACTUATION,
+           std::vector<Sym>(1, Model::ActuationCost(u0, w_delta)));
+
+    u0[Model::DELTA] = Sym::Var(0);
+    u1[Model::DELTA] = Sym::Var(1);
+    u0[Model::A] = Sym::Var(2);
+    u1[Model::A] = Sym::Var(3);
+    Kernel(code, "actuation_change_cost", 2 * Model::N_ACTUATION,
+           std::vector<Sym>(1, Model::ActuationChangeCost(u0, u1, w_ddelta)));
+
+    std::ofstream out(argv[1]);
+    out << "// Generated by mpc_codegen from MPC_Model.h, do not edit.\n\n"
+        << "#include <math.h>\n"
+        << "#include \"MPC_Kernel.h\"\n\n"
+        << code.str();
+    out.close();
+    if (!out) {
+        std::cerr << "Could not write " << argv[1] << std::endl;
+        return -1;
+    }
+    return 0;
+}
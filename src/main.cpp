@@ -1,45 +1,37 @@
 #include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <uWS/uWS.h>
 #include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
-#include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
-#include "MPC.h"
+#include <uv.h>
+#include "BinaryProtocol.h"
+#include "Driver.h"
+#include "MPC_Kernel.h"
+#include "Mailbox.h"
+#include "Metrics.h"
+#include "Profile.h"
+#include "Ring.h"
+#include "SteerWriter.h"
+#include "Telemetry.h"
+#include "TelemetryLog.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 #include "json.hpp"
 
 // for convenience
 using json = nlohmann::json;
 
-// For converting back and forth between radians and degrees.
-constexpr double pi() { return M_PI; }
-double deg2rad(double x) { return x * pi() / 180; }
-double rad2deg(double x) { return x * 180 / pi(); }
-
-/** transform transforms a point in particle coordinates tp one in map coordinates
- */
-
-std::tuple<double, double>transformToMap(double x, double y, double x_car, double y_car, double sigma){
-    
-    double newx = x_car + cos(sigma)*x - sin(sigma)*y;
-    double newy = y_car + sin(sigma)*x + cos(sigma)*y;
-    
-    return std::make_tuple(newx, newy);
-}
-
-std::tuple<double, double>transformToCar(double x, double y, double x_car, double y_car, double sigma){
-    
-    double dx = x - x_car;
-    double dy = y - y_car;
-    double carx= cos(sigma)*dx + sin(sigma)*dy;
-    double cary = -sin(sigma)*dx + cos(sigma)*dy;
-    
-    return std::make_tuple(carx, cary);
-}
-
-
-
 // Checks if the SocketIO event has JSON data.
 // If there is data the JSON object in string format will be returned,
 // else the empty string "" will be returned.
@@ -55,182 +47,725 @@ string hasData(string s) {
     return "";
 }
 
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-    double result = 0.0;
-    for (int i = 0; i < coeffs.size(); i++) {
-        result += coeffs[i] * pow(x, i);
+// Build the reply to `telemetry` in `writer`
+static const std::string& WriteSteer(SteerWriter& writer, const Controller& mpc,
+                                     const Telemetry& telemetry, const Road& road,
+                                     const Controller::SolveResult& result) {
+    double steer_value = SteerValue(result);	// Get values back and scale
+    double throttle_value = result.throttle;
+    
+    // Binary clients only get the actuations
+    if (telemetry.binary) {
+        return writer.Actuation(telemetry.sequence, steer_value, throttle_value, result.fallback);
     }
-    return result;
+    
+    writer.Begin(steer_value, throttle_value);
+    
+    //Display the MPC predicted trajectory
+    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+    // the points in the simulator are connected by a Green line
+    int steps = mpc.layout.size();
+    
+    writer.Array("mpc_x", steps, [&result](int i) { return result.x[i]; });
+    writer.Array("mpc_y", steps, [&result](int i) { return result.y[i]; });
+    
+    
+    // Now we compuite the track but instead of the original points
+    // We use the polynomia so it is smoother
+    
+    double lastx = road.last_x;
+    double step_x = lastx / steps;
+    
+    writer.Array("next_x", steps, [step_x](int i) { return i * step_x; });
+    writer.Array("next_y", steps, [&road, step_x](int i) { return polyeval(road.coeffs, i * step_x); });
+    
+    return writer.End();
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-    assert(xvals.size() == yvals.size());
-    assert(order >= 1 && order <= xvals.size() - 1);
-    Eigen::MatrixXd A(xvals.size(), order + 1);
-    
-    for (int i = 0; i < xvals.size(); i++) {
-        A(i, 0) = 1.0;
+// Longest delay a client may ask for, ms
+static const uint64_t MAX_LATENCY_MS = 10000;
+
+// The latency_ms=<ms> parameter of the query of `url`, at most
+// MAX_LATENCY_MS, or `latency_ms` when there is none or it is not a number
+static uint64_t UrlLatency(const std::string& url, uint64_t latency_ms) {
+    size_t query = url.find('?');
+    while (query != std::string::npos) {
+        if (url.compare(query + 1, 11, "latency_ms=") == 0) {
+            // strtoull would skip spaces and take a sign
+            const char* value = url.c_str() + query + 12;
+            char* stop;
+            unsigned long long ms = strtoull(value, &stop, 10);
+            if (*value < '0' || *value > '9' || (*stop != '\0' && *stop != '&')) {
+                return latency_ms;
+            }
+            return std::min<uint64_t>(ms, MAX_LATENCY_MS);
+        }
+        query = url.find('&', query + 1);
     }
-    
-    for (int j = 0; j < xvals.size(); j++) {
-        for (int i = 0; i < order; i++) {
-            A(j, i + 1) = A(j, i) * xvals(j);
+    return latency_ms;
+}
+
+// One simulator connection, with its own controller so simultaneous
+// simulators do not share a solution or a warm start
+struct Session {
+    uWS::WebSocket<uWS::SERVER> ws;
+    uint32_t id;                    // in the order of connection
+    std::unique_ptr<Controller> mpc;  // solve task only, built by the first one
+    Mailbox<Telemetry> inbox;       // event loop to the solve task
+    SteerWriter writer;             // solve task only
+    Ring<std::string, 4> buffers;   // sent replies, event loop to the solve task
+    std::atomic<bool> scheduled;    // a solve task is queued or running
+    size_t worker;                  // worker its solve tasks are queued on
+
+    // Event loop only
+    bool open;
+    size_t tasks;                   // solve tasks not reported done yet
+    uint64_t latency_ms;            // delay of its replies
+
+    Session(uWS::WebSocket<uWS::SERVER> ws, uint32_t id, std::unique_ptr<Controller>& mpc,
+            size_t worker, uint64_t latency_ms)
+        : ws(ws), id(id), mpc(std::move(mpc)), scheduled(false), worker(worker), open(true),
+          tasks(0), latency_ms(latency_ms) {}
+};
+
+// From a solve task to the event loop: the message to send for a session,
+// or `done` when the task ends and no longer uses the session
+struct Reply {
+    Session* session;
+    std::string msg;
+    uWS::OpCode opcode;
+    bool done;
+};
+
+// Drives every simulator connected to the hub, each through its own
+// session, with a fixed pool of solver threads. The event loop only parses
+// and sends, so frames do not queue up behind a solve and one process can
+// drive many vehicles.
+//
+// Telemetry comes in through the latest-wins mailbox of its session:
+// frames that arrive while the session is queued or solving replace each
+// other and only the newest is solved, the rest are counted as dropped. A
+// session has at most one solve task at a time, so its controller is used
+// by one thread at a time. Replies go back through a queue and a
+// uv_async_t that wakes the loop, which sends them the latency of their
+// session later: they wait in a heap ordered by due time, with one
+// uv_timer_t set for the earliest.
+//
+// CppAD gives each worker its own memory pool (see MPC_NLP::Parallel), and
+// memory has to go back to the pool it came from, so a controller lives on
+// one worker: the tasks of a session are pinned to it and never stolen,
+// and new sessions go to the worker with the fewest. A new session queues a
+// task that builds its controller, and a closed session is freed by a task
+// on its worker once its last solve task is done. The first sessions take
+// the controllers warmed up on the workers by Warmup before the server
+// listens instead, so their first ticks are as fast as the rest. Ipopt
+// solves run in parallel with a thread safe linear solver; with MUMPS they
+// take turns on MPC_NLP::mutex.
+//
+// Both sides count what they do in `metrics`, for /metrics.
+class Server {
+public:
+    // Delay of the replies of sessions opened without one, to emulate the
+    // latency of the actuators
+    uint64_t latency_ms;
+
+    // Records every solve when set
+    LogWriter* log;
+
+    Metrics metrics;
+
+    // At most MPC_NLP::MAX_THREADS - 1 workers
+    Server(const Options& options, uv_loop_t* loop, size_t n_workers)
+        : latency_ms(100), log(NULL), options(options), loop(loop), next_session(0), next_reply(0),
+          armed(0), pool(NewPool(n_workers)) {
+        load.assign(pool->Size(), 0);
+        async.data = this;
+        uv_async_init(loop, &async, Queue);
+        timer.data = this;
+        uv_timer_init(loop, &timer);
+    }
+
+    ~Server() {
+        Stop();
+    }
+
+    // Event loop, once it no longer runs: free the controllers on their
+    // workers, behind the queued solves, join the workers and close the
+    // handles. The replies not sent yet are dropped and later calls find
+    // no session. The loop has to run once more to finish the closing.
+    void Stop() {
+        if (!pool) {
+            return;
         }
+        for (Sessions::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+            closed.push_back(it->second);
+        }
+        sessions.clear();
+        for (size_t i = 0; i < closed.size(); i++) {
+            pool->Submit(std::bind(&Server::Free, closed[i]), closed[i]->worker, true);
+        }
+        closed.clear();
+        for (size_t i = 0; i < spares.size(); i++) {
+            Controller* mpc = spares[i].mpc.release();
+            pool->Submit([mpc] { delete mpc; }, spares[i].worker, true);
+        }
+        spares.clear();
+        pool.reset();
+        delayed.clear();
+        uv_close(reinterpret_cast<uv_handle_t*>(&async), NULL);
+        uv_close(reinterpret_cast<uv_handle_t*>(&timer), NULL);
     }
-    
-    auto Q = A.householderQr();
-    auto result = Q.solve(yvals);
-    return result;
+
+    size_t Workers() const {
+        return pool->Size();
+    }
+
+    // Event loop: start the session of `ws`, which delays its replies by
+    // `latency_ms`
+    void Open(uWS::WebSocket<uWS::SERVER> ws, uint64_t latency_ms) {
+        if (!pool) {
+            return;
+        }
+        Session*& session = sessions[ws];
+        if (session == NULL) {
+            std::unique_ptr<Controller> mpc;
+            size_t worker;
+            if (!spares.empty()) {
+                mpc.swap(spares.back().mpc);
+                worker = spares.back().worker;
+                spares.pop_back();
+            } else {
+                worker = std::min_element(load.begin(), load.end()) - load.begin();
+            }
+            load[worker]++;
+            session = new Session(ws, next_session, mpc, worker, latency_ms);
+            next_session++;
+            session->writer.decimate = options.decimate;
+            metrics.sessions.fetch_add(1, std::memory_order_relaxed);
+            metrics.connections.fetch_add(1, std::memory_order_relaxed);
+
+            // Build the controller before the first telemetry comes in
+            if (!session->mpc) {
+                session->scheduled.store(true);
+                session->tasks++;
+                Submit(session);
+            }
+        }
+    }
+
+    // Before listening: build `n_spares` controllers for the first
+    // sessions and run each through `ticks` ticks of made up telemetry, so
+    // the tape, Ipopt, the CppAD memory pool and the buffers are warm, then
+    // Reset them. `start` is when the process started, Profile::Now.
+    void Warmup(size_t n_spares, int ticks, uint64_t start) {
+        uint64_t warmup_start = Profile::Now();
+        std::vector<double> times;
+        std::vector<uint64_t> ends;
+
+        // Each spare on the worker its session will run on, all at once
+        spares.resize(n_spares);
+        std::mutex done_mutex;
+        std::condition_variable done_wake;
+        size_t done = 0;
+        for (size_t n = 0; n < n_spares; n++) {
+            Spare& spare = spares[n];
+            spare.worker = n % pool->Size();
+            std::vector<double>* spare_times = n == 0 ? &times : NULL;
+            std::vector<uint64_t>* spare_ends = n == 0 ? &ends : NULL;
+            pool->Submit([this, &spare, ticks, spare_times, spare_ends, &done_mutex, &done_wake,
+                          &done] {
+                WarmupSpare(spare, ticks, spare_times, spare_ends);
+                std::lock_guard<std::mutex> lock(done_mutex);
+                done++;
+                done_wake.notify_one();
+            }, spare.worker, true);
+        }
+        {
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done_wake.wait(lock, [&done, n_spares] { return done == n_spares; });
+        }
+        uint64_t warmup_end = Profile::Now();
+        metrics.warmup_seconds = 1e-9 * (warmup_end - warmup_start);
+        if (times.empty()) {
+            return;
+        }
+
+        // Steady state: the median of the second half. Fast: within 1.5
+        // times of it.
+        std::vector<double> steady(times.begin() + times.size() / 2, times.end());
+        std::nth_element(steady.begin(), steady.begin() + steady.size() / 2, steady.end());
+        double median = steady[steady.size() / 2];
+        size_t first = 0;
+        while (first < times.size() && times[first] > 1.5 * median) {
+            first++;
+        }
+        metrics.first_fast_solve_seconds = 1e-9 * (ends[first] - start);
+        std::cout << "Warm-up: " << n_spares << " controllers, " << ticks << " ticks each, in "
+                  << metrics.warmup_seconds << " s. First solve " << 1000.0 * times[0]
+                  << " ms, steady state " << 1000.0 * median << " ms, reached at tick " << first
+                  << ", " << metrics.first_fast_solve_seconds << " s after start" << std::endl;
+
+        // The stage times of the server start from here
+        Profile::Clear();
+    }
+
+    // Event loop: end the session of `ws`
+    void Close(uWS::WebSocket<uWS::SERVER> ws) {
+        Sessions::iterator it = sessions.find(ws);
+        if (it == sessions.end()) {
+            return;
+        }
+        Session* session = it->second;
+        sessions.erase(it);
+        session->open = false;
+        metrics.sessions.fetch_sub(1, std::memory_order_relaxed);
+        std::cout << "Disconnected, " << session->inbox.Dropped() << " stale frames dropped"
+                  << std::endl;
+        if (session->tasks == 0) {
+            Destroy(session);
+        } else {
+            closed.push_back(session);
+        }
+    }
+
+    // Event loop: the telemetry of the session of `ws` to fill before
+    // Post, NULL if it has no session
+    Telemetry* Slot(uWS::WebSocket<uWS::SERVER> ws) {
+        Sessions::iterator it = sessions.find(ws);
+        return it != sessions.end() ? &it->second->inbox.Slot() : NULL;
+    }
+
+    void Post(uWS::WebSocket<uWS::SERVER> ws) {
+        Sessions::iterator it = sessions.find(ws);
+        if (it == sessions.end()) {
+            return;
+        }
+        Session* session = it->second;
+        metrics.frames.fetch_add(1, std::memory_order_relaxed);
+        if (!session->inbox.Post()) {
+            metrics.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!session->scheduled.exchange(true)) {
+            session->tasks++;
+            Submit(session);
+        }
+    }
+
+private:
+    // A reply waiting for its time to be sent
+    struct Delayed {
+        uint64_t due;   // uv_now time
+        uint64_t order; // of arrival, so replies due at once keep it
+        Reply reply;
+
+        // The top of a std heap of them is the earliest
+        bool operator<(const Delayed& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    typedef std::map<uWS::WebSocket<uWS::SERVER>, Session*> Sessions;
+
+    // A controller warmed up on `worker`, for a new session
+    struct Spare {
+        size_t worker;
+        std::unique_ptr<Controller> mpc;
+    };
+
+    const Options options;
+    uv_loop_t* loop;
+    Sessions sessions;              // event loop only, open sessions
+    std::vector<Session*> closed;   // event loop only, waiting for their tasks
+    std::vector<Spare> spares;      // event loop only
+    std::vector<size_t> load;       // event loop only, sessions of each worker
+    uint32_t next_session;
+    std::mutex mutex;
+    std::vector<Reply> replies;     // from the solve tasks, under mutex
+    std::vector<Reply> received;    // event loop only
+    std::vector<Delayed> delayed;   // event loop only, a heap on due time
+    uint64_t next_reply;            // event loop only, order of the next delayed
+    uv_async_t async;
+    uv_timer_t timer;
+    uint64_t armed;                 // event loop only, due time of the timer, 0 when stopped
+    std::unique_ptr<WorkerPool> pool;
+
+    static WorkerPool* NewPool(size_t n_workers) {
+        n_workers = std::max<size_t>(n_workers, 1);
+        MPC_NLP::Parallel(n_workers + 1);
+        return new WorkerPool(n_workers, &Server::StartWorker);
+    }
+
+    // Worker `index`: CppAD thread index + 1, the event loop is 0
+    static void StartWorker(size_t index) {
+        MPC_NLP::Thread(index + 1);
+    }
+
+    // Worker: build a controller into `spare` and run it through `ticks`
+    // ticks, recording the solve times and when they ended if asked to
+    void WarmupSpare(Spare& spare, int ticks, std::vector<double>* times,
+                     std::vector<uint64_t>* ends) {
+        std::unique_ptr<Controller> mpc(new Controller());
+        options.Apply(*mpc);
+        SteerWriter writer;
+        writer.decimate = options.decimate;
+        Telemetry telemetry;
+        for (int k = 0; k < ticks; k++) {
+            DummyTelemetry(k, telemetry);
+            Road road;
+            Controller::SolveResult result = Drive(*mpc, telemetry, road);
+            WriteSteer(writer, *mpc, telemetry, road, result);
+            mpc->Prepare();
+            if (times != NULL) {
+                times->push_back(result.solve_time);
+                ends->push_back(Profile::Now());
+            }
+        }
+        mpc->Reset();
+        spare.mpc.swap(mpc);
+    }
+
+    void Submit(Session* session) {
+        pool->Submit(std::bind(&Server::Solve, this, session), session->worker, true);
+    }
+
+    // Worker: solve the latest telemetry of `session`. The task is queued
+    // again, behind the other sessions of its worker, if more came in.
+    void Solve(Session* session) {
+        Trace::Thread("solver");
+        Trace::Scope trace("tick");
+        if (!session->mpc) {
+            session->mpc.reset(new Controller());
+            options.Apply(*session->mpc);
+        }
+        if (session->inbox.Take()) {
+            Reply reply;
+            reply.session = session;
+            const Telemetry& telemetry = session->inbox.Front();
+            Road road;
+            Controller& mpc = *session->mpc;
+            size_t deadline_misses = mpc.deadline_misses;
+            Controller::SolveResult result = Drive(mpc, telemetry, road);
+            metrics.Solved(result.solve_time, result.iterations, result.fallback,
+                           mpc.deadline_misses != deadline_misses);
+            if (mpc.backend == Controller::COMPARE) {
+                metrics.Compared(mpc.rti_steer_diff, mpc.rti_throttle_diff);
+            }
+            {
+                Profile::Scope scope(Profile::SERIALIZE);
+                WriteSteer(session->writer, mpc, telemetry, road, result);
+
+                // Move the reply out, and write the next one into a sent one
+                session->buffers.Take(reply.msg);
+                session->writer.Swap(reply.msg);
+            }
+            reply.opcode = telemetry.binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+            reply.done = false;
+            Push(reply);
+
+            // After the reply is on its way
+            if (log != NULL) {
+                log->Record(session->id, telemetry, SteerValue(result), result.throttle,
+                            result.cost, result.solve_time, result.status, result.iterations,
+                            result.fallback);
+            }
+
+            // Get the RTI ready for the next message
+            mpc.Prepare();
+        }
+
+        // Telemetry posted after the Take but before the flag is cleared
+        // does not queue a task, so look for it
+        session->scheduled.store(false);
+        if (session->inbox.Ready() && !session->scheduled.exchange(true)) {
+            Submit(session);
+            return;
+        }
+        Reply done;
+        done.session = session;
+        done.opcode = uWS::OpCode::TEXT;
+        done.done = true;
+        Push(done);
+    }
+
+    // Worker: hand `reply` to the event loop
+    void Push(Reply& reply) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            replies.push_back(Reply());
+            replies.back().session = reply.session;
+            replies.back().msg.swap(reply.msg);
+            replies.back().opcode = reply.opcode;
+            replies.back().done = reply.done;
+        }
+        uv_async_send(&async);
+    }
+
+    // Event loop: a session no solve task uses any more, freed on its
+    // worker
+    void Destroy(Session* session) {
+        size_t n = delayed.size();
+        for (size_t i = 0; i < n;) {
+            if (delayed[i].reply.session == session) {
+                std::swap(delayed[i], delayed[--n]);
+            } else {
+                i++;
+            }
+        }
+        if (n < delayed.size()) {
+            delayed.resize(n);
+            std::make_heap(delayed.begin(), delayed.end());
+        }
+        closed.erase(std::remove(closed.begin(), closed.end(), session), closed.end());
+        load[session->worker]--;
+        pool->Submit(std::bind(&Server::Free, session), session->worker, true);
+    }
+
+    // Worker: free `session` and its controller
+    static void Free(Session* session) {
+        delete session;
+    }
+
+    // Event loop: queue the replies of the pool to be sent after the
+    // latency.
+    //
+    // Latency
+    // The purpose is to mimic real driving conditions where
+    // the car does actuate the commands instantly.
+    //
+    // Feel free to play around with this value but should be to drive
+    // around the track with 100ms latency.
+    //
+    // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+    // SUBMITTING.
+    static void Queue(uv_async_t* handle) {
+        Server* server = static_cast<Server*>(handle->data);
+        {
+            std::lock_guard<std::mutex> lock(server->mutex);
+            server->received.swap(server->replies);
+        }
+        uint64_t now = uv_now(server->loop);
+        for (size_t i = 0; i < server->received.size(); i++) {
+            Reply& reply = server->received[i];
+            Session* session = reply.session;
+            if (!reply.done) {
+                server->delayed.push_back(Delayed());
+                Delayed& delayed = server->delayed.back();
+                delayed.due = now + session->latency_ms;
+                delayed.order = server->next_reply++;
+                delayed.reply.session = session;
+                delayed.reply.msg.swap(reply.msg);
+                delayed.reply.opcode = reply.opcode;
+                delayed.reply.done = false;
+                std::push_heap(server->delayed.begin(), server->delayed.end());
+            } else if (--session->tasks == 0 && !session->open) {
+                server->Destroy(session);
+            }
+        }
+        server->received.clear();
+        server->Arm(now);
+    }
+
+    // Event loop: set the timer for the earliest reply, unless it is set
+    // for that or earlier already
+    void Arm(uint64_t now) {
+        if (delayed.empty() || (armed != 0 && armed <= delayed.front().due)) {
+            return;
+        }
+        armed = delayed.front().due;
+        uv_timer_start(&timer, Send, armed > now ? armed - now : 0, 0);
+    }
+
+    // Event loop: send the replies that are due, if their session is still
+    // open, and wait for the next one
+    static void Send(uv_timer_t* handle) {
+        Server* server = static_cast<Server*>(handle->data);
+        uint64_t now = uv_now(server->loop);
+        server->armed = 0;
+        while (!server->delayed.empty() && server->delayed.front().due <= now) {
+            std::pop_heap(server->delayed.begin(), server->delayed.end());
+            Reply& reply = server->delayed.back().reply;
+            if (reply.session->open) {
+                Profile::Scope scope(Profile::SEND);
+                reply.session->ws.send(reply.msg.data(), reply.msg.length(), reply.opcode);
+            }
+            reply.session->buffers.Give(reply.msg);
+            server->delayed.pop_back();
+        }
+        server->Arm(now);
+    }
+};
+
+// SIGINT or SIGTERM: stop listening, close the connections and stop the
+// loop, so main shuts the server, the trace and the log down in order
+struct Shutdown {
+    uWS::Hub* hub;
+    uv_signal_t signals[2];
+};
+
+static void OnSignal(uv_signal_t* handle, int signum) {
+    Shutdown* shutdown = static_cast<Shutdown*>(handle->data);
+    std::cout << "Stopping on signal " << signum << std::endl;
+    shutdown->hub->getDefaultGroup<uWS::SERVER>().close();
+    for (int i = 0; i < 2; i++) {
+        uv_close(reinterpret_cast<uv_handle_t*>(&shutdown->signals[i]), NULL);
+    }
+    uv_stop(handle->loop);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    uint64_t start = Profile::Now();
+    
+    // Freed CppAD memory stays in its pool for the next controller
+    CppAD::thread_alloc::hold_memory(true);
     
     uWS::Hub h;
     
-    // MPC is initialized here!
-    MPC mpc;
+    // Each session initializes its own MPC with these options
+    Options options;
+    
+    // Solver backend: --backend=ipopt (default), rti or compare
+    // RTI QP steps: --kkt=riccati (default) or condensed
+    // Ipopt derivatives: --derivatives=generated (default), analytic or tape
+    // --linear-solver=<name> of Ipopt, ma27 when Ipopt has it and mumps otherwise
+    // --no-warm-start solves from zero rather than from the shifted previous solution
+    // --deadline=<ms> bounds the time of each Ipopt solve
+    // --latency=<ms> delays the replies to emulate the actuators, 100 by default
+    // --workers=<n> solver threads shared by the sessions, one per core by default
+    // --decimate=<k> sends every k-th point of the trajectories drawn by the simulator, none when 0
+    // --record=<file> logs every solve for mpc_replay
+    // --profile prints the time of each stage of the ticks when a simulator disconnects
+    // --trace=<file> writes a timeline of the ticks for chrome://tracing or Perfetto
+    // --counters adds up cycles, instructions, cache and branch misses per stage
+    // --warmup=<ticks> of made up telemetry for each spare controller before listening, 50 by default
+    // --spares=<n> controllers warmed up for the first sessions, 1 by default
+    int latency_ms = 100;
+    int workers = std::thread::hardware_concurrency();
+    string record;
+    bool profile = false;
+    string trace;
+    bool counters = false;
+    int warmup = 50;
+    int spares = 1;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (options.Parse(arg)) {
+            continue;
+        } else if (arg.compare(0, 10, "--latency=") == 0) {
+            latency_ms = atoi(arg.c_str() + 10);
+        } else if (arg.compare(0, 10, "--workers=") == 0) {
+            workers = atoi(arg.c_str() + 10);
+        } else if (arg.compare(0, 9, "--record=") == 0) {
+            record = arg.substr(9);
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg.compare(0, 8, "--trace=") == 0) {
+            trace = arg.substr(8);
+        } else if (arg == "--counters") {
+            counters = true;
+        } else if (arg.compare(0, 9, "--warmup=") == 0) {
+            warmup = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 9, "--spares=") == 0) {
+            spares = atoi(arg.c_str() + 9);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+    
+    // Before the server, which may still record while it stops
+    LogWriter log;
+    if (!record.empty() && !log.Open(record)) {
+        std::cerr << "Cannot write " << record << std::endl;
+        return -1;
+    }
     
-    h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                       uWS::OpCode opCode) {
+    Trace::Thread("event loop");
+    if (counters && !PerfCounters::Enable()) {
+        std::cerr << "Cannot open the hardware counters, see perf_event_paranoid" << std::endl;
+    }
+    if (!trace.empty() && !Trace::Start(trace)) {
+        std::cerr << "Cannot write " << trace << std::endl;
+        return -1;
+    }
+    
+    // Ipopt solves only run in parallel with an HSL linear solver
+    if (options.linear_solver.empty() && options.backend != Controller::RTI) {
+        Controller probe;
+        probe.SetLinearSolver("ma27");
+        options.linear_solver = probe.Probe() ? "ma27" : "mumps";
+    }
+    if (options.backend != Controller::RTI && !MPC_NLP::ThreadSafe(options.linear_solver)) {
+        std::cout << "Ipopt solves with " << options.linear_solver << " take turns, "
+                  << "use an HSL linear solver (--linear-solver=ma27) to run them in parallel"
+                  << std::endl;
+    }
+    
+    workers = std::max(1, std::min(workers, int(MPC_NLP::MAX_THREADS) - 1));
+    Server server(options, h.getLoop(), workers);
+    server.latency_ms = latency_ms;
+    if (!record.empty()) {
+        server.log = &log;
+        server.metrics.log = &log;
+    }
+    
+    h.onMessage([&server](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
+                          uWS::OpCode opCode) {
+        Trace::Scope trace("message");
+        
+        // Telemetry is read straight from the frame into the session
+        Telemetry* telemetry = server.Slot(ws);
+        Profile::Mark start = Profile::Start();
+        if (opCode == uWS::OpCode::BINARY) {
+            if (telemetry != NULL && ReadTelemetryFrame(data, length, *telemetry)) {
+                Profile::Since(Profile::PARSE, start);
+                server.Post(ws);
+            }
+            return;
+        }
+        if (telemetry != NULL && ParseTelemetry(data, length, *telemetry)) {
+            Profile::Since(Profile::PARSE, start);
+            server.Post(ws);
+            return;
+        }
+        
+        // Anything else goes through the json parser
         // "42" at the start of the message means there's a websocket message event.
         // The 4 signifies a websocket message
         // The 2 signifies a websocket event
-        string sdata = string(data).substr(0, length);
+        start = Profile::Start();
+        string sdata(data, length);
+        Profile::Since(Profile::COPY, start);
         if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
             //cout << sdata << endl;
+            start = Profile::Start();
             string s = hasData(sdata);
+            Profile::Since(Profile::HAS_DATA, start);
             if (s != "") {
+                start = Profile::Start();
                 auto j = json::parse(s);
                 string event = j[0].get<string>();
                 if (event == "telemetry") {
                     // j[1] is the data JSON object
-                    vector<double> ptsx = j[1]["ptsx"];
-                    vector<double> ptsy = j[1]["ptsy"];
-                    double px = j[1]["x"];
-                    double py = j[1]["y"];
-                    double psi = j[1]["psi"];
-                    double v = j[1]["speed"];
-                    /*
-                     * TODO: Calculate steering angle and throttle using MPC.
-                     *
-                     * Both are in between [-1, 1].
-                     *
-                     */
-                    
-                    double steer_value;
-                    double throttle_value;
-                    
-                    Eigen::VectorXd vptsx(ptsx.size());
-                    Eigen::VectorXd vptsy(ptsy.size());
-                    
-                    // Apply car equations so we get the position after the delay
-                    
-                    // Convert waypoints to car coordinates. We do all math in car coordinates
-
-                    for(int i = 0; i < ptsx.size(); i++){
-                        
-                        double newx;
-                        double newy;
-                        
-                        std::tie(newx, newy) = transformToCar(ptsx[i], ptsy[i], px, py, psi);
-                        
-                        vptsx(i) = newx;
-                        vptsy(i) = newy;
-                    }
-                    // Build a polynomium for the track
-                    
-                    auto coeffs = polyfit(vptsx, vptsy, 3);
-                    
-                    // Compoute initial errors. cte is computed as the difference between the track and car position at same x
-		   // epsi is the difference in angles
-                    
-                    double cte = coeffs(0); //  double cte = polyeval(coeffs, px) - py;
-                    
-                    double epsi =  atan(coeffs(1));
-                    
-                    Eigen::VectorXd state(6);
-
-		    // As we have converted to car coordinates, initial x, y and psi are 0.0, no need to compute anything
-
-                    state << 0.0, 0.0, 0.0, v, cte, epsi;
-                    
-                    std::vector<double> x_vals = {state[0]};
-                    std::vector<double> y_vals = {state[1]};
-                    std::vector<double> psi_vals = {state[2]};
-                    std::vector<double> v_vals = {state[3]};
-                    std::vector<double> cte_vals = {state[4]};
-                    std::vector<double> epsi_vals = {state[5]};
-                    std::vector<double> delta_vals = {};
-                    std::vector<double> a_vals = {};
-                    
-                    auto vars = mpc.Solve(state, coeffs);	// OK, solve th problem
-                    
-                    steer_value = -vars[6] / deg2rad(25);	// Get values back and scale
-                    throttle_value = vars[7];
-                    
-                    json msgJson;
-
-                    msgJson["steering_angle"] = steer_value;
-                    msgJson["throttle"] = throttle_value;
-                    
-                    //Display the MPC predicted trajectory
-                    vector<double> mpc_x_vals(ptsx.size());
-                    vector<double> mpc_y_vals(ptsx.size());
-                    
-                    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-                    // the points in the simulator are connected by a Green line
-		    // We have moved solution to an instance variable so it is accesible
-
-                    int steps = 15;
-                    for(int i = 0; i < steps; i++){
-                        mpc_x_vals.push_back(mpc.solution.x[0+i]);
-                        mpc_y_vals.push_back(mpc.solution.x[steps+i]);
+                    vector<double> ptsx = j[1]["ptsx"].get<vector<double> >();
+                    vector<double> ptsy = j[1]["ptsy"].get<vector<double> >();
+                    if (telemetry == NULL || ptsx.size() != ptsy.size() ||
+                        ptsx.size() > size_t(MAX_WAYPOINTS)) {
+                        return;
                     }
-
-                    
-                    msgJson["mpc_x"] = mpc_x_vals;
-                    msgJson["mpc_y"] = mpc_y_vals;
-                    
-                    
-                    // Now we compuite the track but instead of the original points
-		    // We use the polynomia so it is smoother
-
-                    vector<double> next_x_vals;
-                    vector<double> next_y_vals;
-                    
-                    double lastx = vptsx(vptsx.size()-1);
-                    double step_x = lastx / steps;
-                    double current_x = 0.0;
-
-                    for (int i = 0; i < steps; i++){
-                        
-                        next_x_vals.push_back(current_x);
-                        next_y_vals.push_back(polyeval(coeffs, current_x));
-                        current_x += step_x;
+                    if (ptsx.size() <= size_t(KERNEL_ORDER)) {
+                        std::cout << "Dropped telemetry with " << ptsx.size()
+                                  << " waypoints, too few to fit the road" << std::endl;
+                        return;
                     }
-                    
-                    msgJson["next_x"] = next_x_vals;
-                    msgJson["next_y"] = next_y_vals;
-                    
-                    
-                    auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-                    //std::cout << msg << std::endl;
-                    // Latency
-                    // The purpose is to mimic real driving conditions where
-                    // the car does actuate the commands instantly.
-                    //
-                    // Feel free to play around with this value but should be to drive
-                    // around the track with 100ms latency.
-                    //
-                    // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-                    // SUBMITTING.
-                    this_thread::sleep_for(chrono::milliseconds(100));
-                    ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+                    telemetry->ptsx = Eigen::Map<const Eigen::VectorXd>(ptsx.data(), ptsx.size());
+                    telemetry->ptsy = Eigen::Map<const Eigen::VectorXd>(ptsy.data(), ptsy.size());
+                    telemetry->px = j[1]["x"];
+                    telemetry->py = j[1]["y"];
+                    telemetry->psi = j[1]["psi"];
+                    telemetry->v = j[1]["speed"];
+                    telemetry->binary = false;
+                    Profile::Since(Profile::JSON, start);
+                    server.Post(ws);
                 }
             } else {
                 // Manual driving
@@ -240,13 +775,21 @@ int main() {
         }
     });
     
-    // We don't need this since we're not using HTTP but if it's removed the
-    // program
-    // doesn't compile :-(
-    h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                       size_t, size_t) {
+    // /metrics gives the counters of the server in the Prometheus text
+    // format. It only reads atomics, so a scrape does not hold up the solves.
+    std::string metrics;
+    h.onHttpRequest([&server, &metrics](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
+                                        size_t, size_t) {
+        uWS::Header url = req.getUrl();
+        std::string path = url.toString();
+        path.resize(std::min(path.find('?'), path.size()));
+        if (path == "/metrics") {
+            server.metrics.Write(metrics);
+            res->end(metrics.data(), metrics.length());
+            return;
+        }
         const std::string s = "<h1>Hello world!</h1>";
-        if (req.getUrl().valueLength == 1) {
+        if (url.valueLength == 1) {
             res->end(s.data(), s.length());
         } else {
             // i guess this should be done more gracefully?
@@ -254,16 +797,26 @@ int main() {
         }
     });
     
-    h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+    // ws://host:4567/?latency_ms=<ms> asks for a latency other than --latency
+    h.onConnection([&server](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+        server.Open(ws, UrlLatency(req.getUrl().toString(), server.latency_ms));
         std::cout << "Connected!!!" << std::endl;
     });
     
-    h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                           char *message, size_t length) {
+    h.onDisconnection([&server, profile](uWS::WebSocket<uWS::SERVER> ws, int code,
+                                         char *message, size_t length) {
+        server.Close(ws);
+        if (profile) {
+            Profile::Print(std::cout);
+        }
         ws.close();
-        std::cout << "Disconnected" << std::endl;
     });
     
+    // Tape, Ipopt, memory pools and buffers, before the first simulator
+    if (warmup > 0 && spares > 0) {
+        server.Warmup(spares, warmup, start);
+    }
+    
     int port = 4567;
     if (h.listen(port)) {
         std::cout << "Listening to port " << port << std::endl;
@@ -271,5 +824,20 @@ int main() {
         std::cerr << "Failed to listen to port" << std::endl;
         return -1;
     }
+    Shutdown shutdown;
+    shutdown.hub = &h;
+    const int signums[] = {SIGINT, SIGTERM};
+    for (int i = 0; i < 2; i++) {
+        uv_signal_init(h.getLoop(), &shutdown.signals[i]);
+        shutdown.signals[i].data = &shutdown;
+        uv_signal_start(&shutdown.signals[i], OnSignal, signums[i]);
+    }
     h.run();
+    
+    // The log and the trace take what the workers record until they stop
+    server.Stop();
+    uv_run(h.getLoop(), UV_RUN_NOWAIT);
+    Trace::Stop();
+    log.Close();
+    std::cout << "Stopped" << std::endl;
 }
@@ -0,0 +1,124 @@
+// Feeds a log written by `mpc --record=<file>` through the controller as
+// fast as it can, without the simulator or uWS, to profile it and to check
+// that it still answers what it answered when the log was recorded.
+//
+// Usage: mpc_replay <log> [controller options] [--repeat=<n>] [--tolerance=<t>]
+//
+// Each session of the log gets its own controller, as in the server. With
+// --tolerance it exits with 1 if a steering or throttle value differs from
+// the recorded one by more than <t>, or with --backend=compare if RTI
+// differs from Ipopt by more than that.
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include "Driver.h"
+#include "Profile.h"
+#include "TelemetryLog.h"
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::string path;
+    int repeat = 1;
+    double tolerance = -1.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (options.Parse(arg)) {
+            continue;
+        } else if (arg.compare(0, 9, "--repeat=") == 0) {
+            repeat = atoi(arg.c_str() + 9);
+        } else if (arg.compare(0, 12, "--tolerance=") == 0) {
+            tolerance = atof(arg.c_str() + 12);
+        } else if (arg.compare(0, 2, "--") != 0 && path.empty()) {
+            path = arg;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: mpc_replay <log> [options]" << std::endl;
+        return -1;
+    }
+
+    LogReader reader;
+    if (!reader.Open(path)) {
+        std::cerr << "Cannot read " << path << std::endl;
+        return -1;
+    }
+
+    std::map<uint32_t, std::unique_ptr<Controller> > controllers;
+    Telemetry telemetry;
+    Road road;
+    const LogRecord* record;
+    const double* ptsx;
+    const double* ptsy;
+
+    size_t solves = 0;
+    size_t fallbacks = 0;
+    double solve_time = 0.0;
+    double max_solve_time = 0.0;
+    double max_steer_diff = 0.0;
+    double max_throttle_diff = 0.0;
+    double rti_max_steer_diff = 0.0;
+    double rti_max_throttle_diff = 0.0;
+    Clock::time_point start = Clock::now();
+
+    for (int pass = 0; pass < repeat; pass++) {
+        // Every pass starts from cold controllers, as the recording did
+        controllers.clear();
+        reader.Rewind();
+        while (reader.Next(record, ptsx, ptsy)) {
+            std::unique_ptr<Controller>& mpc = controllers[record->session];
+            if (!mpc) {
+                mpc.reset(new Controller());
+                options.Apply(*mpc);
+            }
+            LogReader::ToTelemetry(*record, ptsx, ptsy, telemetry);
+            Controller::SolveResult result = Drive(*mpc, telemetry, road);
+            mpc->Prepare();
+
+            solves++;
+            fallbacks += result.fallback;
+            solve_time += result.solve_time;
+            max_solve_time = std::max(max_solve_time, result.solve_time);
+            max_steer_diff = std::max(max_steer_diff,
+                                      fabs(SteerValue(result) - record->steering_angle));
+            max_throttle_diff = std::max(max_throttle_diff,
+                                         fabs(result.throttle - record->throttle));
+            rti_max_steer_diff = std::max(rti_max_steer_diff, mpc->rti_steer_diff);
+            rti_max_throttle_diff = std::max(rti_max_throttle_diff, mpc->rti_throttle_diff);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Solves " << solves << " in " << elapsed << " s, "
+              << (elapsed > 0 ? solves / elapsed : 0.0) << " per second" << std::endl;
+    if (solves > 0) {
+        std::cout << "Solve time mean " << 1000.0 * solve_time / solves << " ms, max "
+                  << 1000.0 * max_solve_time << " ms, fallbacks " << fallbacks << std::endl;
+    }
+    std::cout << "Max diff to the recording: steering " << max_steer_diff << " throttle "
+              << max_throttle_diff << std::endl;
+    bool compare = options.backend == Controller::COMPARE;
+    if (compare) {
+        std::cout << "RTI vs Ipopt max diff: steering " << rti_max_steer_diff << " throttle "
+                  << rti_max_throttle_diff << std::endl;
+    }
+    Profile::Print(std::cout);
+
+    if (tolerance >= 0.0 && (max_steer_diff > tolerance || max_throttle_diff > tolerance)) {
+        return 1;
+    }
+    if (tolerance >= 0.0 && compare &&
+        (rti_max_steer_diff > tolerance || rti_max_throttle_diff > tolerance)) {
+        return 1;
+    }
+    return 0;
+}
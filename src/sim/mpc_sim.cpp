@@ -0,0 +1,263 @@
+// Drives laps of a track with the controller in closed loop, without the
+// Unity simulator and as fast as the controller runs.
+//
+// Usage: mpc_sim [controller options] [--track=<csv>] [--laps=<n>]
+//                [--latency=<ms>] [--period=<ms>] [--accel=<m/s^2>]
+//
+// The car is a kinematic bicycle. Every `period` of simulated time it sends
+// telemetry shaped like the simulator's (see DATA.md): the position in
+// meters, psi, the speed in mph and the next waypoints of the track as
+// ptsx/ptsy. The steering and throttle of the reply are applied `latency`
+// later; steering 1 is 25 degrees to the right and throttle 1 gives
+// `accel`. It reports the time and the cross track error of each lap and
+// the percentiles of the solve latency, and exits with 1 if the car leaves
+// the track.
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Driver.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const double MPH = 0.44704;          // m/s
+static const int N_WAYPOINTS = 6;           // sent by the simulator
+static const double OFF_TRACK = 8.0;        // m from the center line
+
+// Closed polyline of waypoints
+struct Track {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> s;      // distance along the track to each waypoint
+    double length;
+
+    bool Load(const std::string& path) {
+        std::ifstream in(path.c_str());
+        std::string line;
+        if (!std::getline(in, line)) {
+            return false;
+        }
+        while (std::getline(in, line)) {
+            double px;
+            double py;
+            char comma;
+            std::istringstream fields(line);
+            if (fields >> px >> comma >> py) {
+                x.push_back(px);
+                y.push_back(py);
+            }
+        }
+        if (x.size() < N_WAYPOINTS) {
+            return false;
+        }
+        length = 0.0;
+        for (size_t i = 0; i < x.size(); i++) {
+            s.push_back(length);
+            length += hypot(x[Next(i)] - x[i], y[Next(i)] - y[i]);
+        }
+        return true;
+    }
+
+    size_t Next(size_t i) const {
+        return (i + 1) % x.size();
+    }
+
+    // Closest point of the track to (px, py): its segment, its distance
+    // along the track and its distance to (px, py)
+    void Project(double px, double py, size_t& segment, double& station, double& distance) const {
+        distance = INFINITY;
+        for (size_t i = 0; i < x.size(); i++) {
+            double dx = x[Next(i)] - x[i];
+            double dy = y[Next(i)] - y[i];
+            double l2 = dx * dx + dy * dy;
+            double t = std::max(0.0, std::min(1.0, ((px - x[i]) * dx + (py - y[i]) * dy) / l2));
+            double d = hypot(px - (x[i] + t * dx), py - (y[i] + t * dy));
+            if (d < distance) {
+                distance = d;
+                segment = i;
+                station = s[i] + t * sqrt(l2);
+            }
+        }
+    }
+};
+
+// Actuations on their way to the car
+struct Command {
+    double time;
+    double steer;
+    double throttle;
+};
+
+static double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::string path;
+    int laps = 3;
+    double latency = 0.1;
+    double period = 0.1;
+    double accel = 5.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (options.Parse(arg)) {
+            continue;
+        } else if (arg.compare(0, 8, "--track=") == 0) {
+            path = arg.substr(8);
+        } else if (arg.compare(0, 7, "--laps=") == 0) {
+            laps = atoi(arg.c_str() + 7);
+        } else if (arg.compare(0, 10, "--latency=") == 0) {
+            latency = atof(arg.c_str() + 10) / 1000.0;
+        } else if (arg.compare(0, 9, "--period=") == 0) {
+            period = atof(arg.c_str() + 9) / 1000.0;
+        } else if (arg.compare(0, 8, "--accel=") == 0) {
+            accel = atof(arg.c_str() + 8);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    // From the build directory or from the top of the repository
+    Track track;
+    bool loaded = path.empty() ? track.Load("../lake_track_waypoints.csv") ||
+                                 track.Load("lake_track_waypoints.csv")
+                               : track.Load(path);
+    if (!loaded || period <= 0.0) {
+        std::cerr << "Cannot read the track " << path << std::endl;
+        return -1;
+    }
+
+    Controller mpc;
+    options.Apply(mpc);
+    double Lf = mpc.config.Lf;
+
+    // The car starts stopped on the first waypoint, facing the second
+    double x = track.x[0];
+    double y = track.y[0];
+    double psi = atan2(track.y[1] - y, track.x[1] - x);
+    double v = 0.0;
+    double steer = 0.0;
+    double throttle = 0.0;
+
+    std::deque<Command> commands;
+    std::vector<double> solve_times;
+    Telemetry telemetry;
+    telemetry.binary = false;
+    telemetry.sequence = 0;
+    Road road;
+
+    const double h = 0.005;             // integration step, s
+    double time = 0.0;
+    double next_tick = 0.0;
+    double lap_start = 0.0;
+    double progress = 0.0;              // along the track since the start
+    double last_station = 0.0;
+    int lap = 0;
+    double cte_sum = 0.0;
+    double cte_max = 0.0;
+    size_t cte_samples = 0;
+    double max_time = 600.0 * laps;
+    Clock::time_point start = Clock::now();
+
+    while (lap < laps) {
+        size_t segment;
+        double station;
+        double cte;
+        track.Project(x, y, segment, station, cte);
+
+        if (time >= next_tick) {
+            next_tick += period;
+
+            // The simulator sends waypoints from the one behind the car
+            telemetry.ptsx.resize(N_WAYPOINTS);
+            telemetry.ptsy.resize(N_WAYPOINTS);
+            for (int i = 0; i < N_WAYPOINTS; i++) {
+                size_t k = (segment + i) % track.x.size();
+                telemetry.ptsx[i] = track.x[k];
+                telemetry.ptsy[i] = track.y[k];
+            }
+            telemetry.px = x;
+            telemetry.py = y;
+            telemetry.psi = psi;
+            telemetry.v = v / MPH;
+
+            Clock::time_point solve_start = Clock::now();
+            Controller::SolveResult result = Drive(mpc, telemetry, road);
+            solve_times.push_back(std::chrono::duration<double>(Clock::now() - solve_start).count());
+            mpc.Prepare();
+
+            Command command;
+            command.time = time + latency;
+            command.steer = SteerValue(result);
+            command.throttle = result.throttle;
+            commands.push_back(command);
+
+            cte_sum += cte;
+            cte_max = std::max(cte_max, cte);
+            cte_samples++;
+        }
+
+        if (cte > OFF_TRACK || time > max_time) {
+            std::cout << (cte > OFF_TRACK ? "Off the track" : "Out of time") << " at " << time
+                      << " s, " << progress << " m into lap " << lap + 1 << std::endl;
+            return 1;
+        }
+
+        while (!commands.empty() && commands.front().time <= time) {
+            steer = std::max(-1.0, std::min(1.0, commands.front().steer));
+            throttle = std::max(-1.0, std::min(1.0, commands.front().throttle));
+            commands.pop_front();
+        }
+
+        // Kinematic bicycle, with the controller's sign for the steering
+        double delta = -steer * deg2rad(25);
+        x += v * cos(psi) * h;
+        y += v * sin(psi) * h;
+        psi += v / Lf * delta * h;
+        v = std::max(0.0, v + throttle * accel * h);
+        time += h;
+
+        // Laps by the distance driven along the track
+        double ds = station - last_station;
+        if (ds < -track.length / 2) {
+            ds += track.length;
+        } else if (ds > track.length / 2) {
+            ds -= track.length;
+        }
+        progress += ds;
+        last_station = station;
+        if (progress >= track.length) {
+            progress -= track.length;
+            lap++;
+            std::cout << "Lap " << lap << ": " << time - lap_start << " s, cte mean "
+                      << cte_sum / cte_samples << " m max " << cte_max << " m" << std::endl;
+            lap_start = time;
+            cte_sum = 0.0;
+            cte_max = 0.0;
+            cte_samples = 0;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Solve latency p50 " << 1000.0 * Percentile(solve_times, 0.5) << " ms p90 "
+              << 1000.0 * Percentile(solve_times, 0.9) << " ms p99 "
+              << 1000.0 * Percentile(solve_times, 0.99) << " ms max "
+              << 1000.0 * Percentile(solve_times, 1.0) << " ms" << std::endl;
+    std::cout << "Simulated " << time << " s in " << elapsed << " s, "
+              << solve_times.size() << " solves, fallbacks " << mpc.fallbacks << std::endl;
+    return 0;
+}
@@ -0,0 +1,220 @@
+// Checks of the controller, run by ctest (see CMakeLists.txt).
+//
+// Usage: mpc_tests [controller options] <check>...
+//
+// Runs the named checks in order with a controller built with the options,
+// prints what each measured and exits with 1 if one of them failed.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "AllocationCounter.h"
+#include "BinaryProtocol.h"
+#include "Driver.h"
+#include "MPC_Kernel.h"
+#include "Telemetry.h"
+
+// Whether the generated and analytic derivatives agree with the tape at
+// random points
+static bool CheckDerivatives(const Options& options) {
+    Controller mpc;
+    options.Apply(mpc);
+    double err = mpc.CheckDerivatives(100);
+    std::cout << "Generated and analytic vs tape derivatives max diff: " << err << std::endl;
+    return err < 1e-8;
+}
+
+// Whether the steady state ticks on a fixed road, Solve and Prepare, make
+// no heap allocation outside Ipopt's own code (see AllocationCounter.h)
+static bool CheckAllocations(const Options& options) {
+    Controller mpc;
+    options.Apply(mpc);
+    Controller::State state;
+    state << 0.0, 0.0, 0.0, 40.0, 0.5, 0.05;
+    Controller::Coeffs coeffs = Controller::Coeffs::Zero(mpc.layout.order() + 1);
+    coeffs[0] = 0.5;
+    coeffs[1] = 0.05;
+    coeffs[2] = 0.001;
+
+    // The first ticks size the buffers of the solver and the warm start
+    for (int k = 0; k < 3; k++) {
+        mpc.Solve(state, coeffs);
+        mpc.Prepare();
+    }
+
+    size_t worst = 0;
+    for (int k = 0; k < 20; k++) {
+        AllocationCounter::Start();
+        mpc.Solve(state, coeffs);
+        mpc.Prepare();
+        worst = std::max(worst, AllocationCounter::Stop());
+    }
+    std::cout << "Heap allocations per steady state tick: " << worst
+              << (AllocationCounter::COMPLETE ? "" : " (operator new only)") << std::endl;
+    return worst == 0;
+}
+
+// Whether the text parser takes the roads it can fit and turns down those
+// with too few waypoints, `KERNEL_ORDER` or less, or with a value that is
+// not a finite number. Prints the frames that fail.
+static bool CheckTextFrames(const Options& options) {
+    bool ok = true;
+    Telemetry telemetry;
+    for (int n = 0; n <= KERNEL_ORDER + 2; n++) {
+        std::string points;
+        for (int i = 0; i < n; i++) {
+            points += (i > 0 ? "," : "") + std::to_string(10.0 * i);
+        }
+        std::string text = "42[\"telemetry\",{\"ptsx\":[" + points + "],\"ptsy\":[" + points +
+            "],\"x\":0,\"y\":0,\"psi\":0,\"speed\":10}]";
+        bool expected = n > KERNEL_ORDER;
+        if (ParseTelemetry(text.data(), text.length(), telemetry) != expected) {
+            std::cout << "Text frame with " << n << " waypoints "
+                      << (expected ? "rejected" : "accepted") << std::endl;
+            ok = false;
+        }
+    }
+
+    // Values that are not finite json numbers
+    const char* values[] = {"nan", "-nan", "inf", "-infinity", "1e999", "0x10"};
+    for (const char* value : values) {
+        std::string speed = "42[\"telemetry\",{\"ptsx\":[0,10,20,30,40],\"ptsy\":[0,10,20,30,40],"
+            "\"x\":0,\"y\":0,\"psi\":0,\"speed\":" + std::string(value) + "}]";
+        std::string point = "42[\"telemetry\",{\"ptsx\":[0,10," + std::string(value) +
+            ",30,40],\"ptsy\":[0,10,20,30,40],\"x\":0,\"y\":0,\"psi\":0,\"speed\":10}]";
+        if (ParseTelemetry(speed.data(), speed.length(), telemetry) ||
+            ParseTelemetry(point.data(), point.length(), telemetry)) {
+            std::cout << "Text frame with " << value << " accepted" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// The same for the binary parser, with zeroed waypoints, and a nan or an
+// inf for a value
+static bool CheckBinaryFrames(const Options& options) {
+    bool ok = true;
+    Telemetry telemetry;
+    TelemetryFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = TELEMETRY_MAGIC;
+    frame.version = PROTOCOL_VERSION;
+    for (int n = 0; n <= KERNEL_ORDER + 2; n++) {
+        frame.n_points = n;
+        bool expected = n > KERNEL_ORDER;
+        if (ReadTelemetryFrame(reinterpret_cast<const char*>(&frame), sizeof(frame), telemetry) !=
+            expected) {
+            std::cout << "Binary frame with " << n << " waypoints "
+                      << (expected ? "rejected" : "accepted") << std::endl;
+            ok = false;
+        }
+    }
+
+    const double values[] = {NAN, INFINITY, -INFINITY};
+    for (double value : values) {
+        frame.speed = value;
+        frame.ptsx[1] = 0.0;
+        bool speed = ReadTelemetryFrame(reinterpret_cast<const char*>(&frame), sizeof(frame),
+                                        telemetry);
+        frame.speed = 0.0;
+        frame.ptsx[1] = value;
+        bool point = ReadTelemetryFrame(reinterpret_cast<const char*>(&frame), sizeof(frame),
+                                        telemetry);
+        frame.ptsx[1] = 0.0;
+        if (speed || point) {
+            std::cout << "Binary frame with " << value << " accepted" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Whether a controller whose Ipopt solve fails falls back to the previous
+// plan, or to no steering and no throttle before it has one. A deadline
+// that stops Ipopt at its cold starting point makes it fail. Prints the
+// ticks that fail.
+static bool CheckFallback(const Options& options) {
+    Controller mpc;
+    options.Apply(mpc);
+    mpc.backend = Controller::IPOPT;
+    mpc.warm_start = false;
+    Telemetry telemetry;
+    Road road;
+    bool ok = true;
+
+    mpc.deadline = 1e-9;
+    DummyTelemetry(0, telemetry);
+    Controller::SolveResult result = Drive(mpc, telemetry, road);
+    if (!result.fallback || result.steer != 0 || result.throttle != 0 || mpc.fallbacks != 1) {
+        std::cout << "First tick failed with steering " << result.steer << " throttle "
+                  << result.throttle << (result.fallback ? "" : " not") << " as a fallback"
+                  << std::endl;
+        ok = false;
+    }
+
+    // Now with a plan to fall back on
+    mpc.deadline = 0;
+    DummyTelemetry(1, telemetry);
+    Drive(mpc, telemetry, road);
+    mpc.deadline = 1e-9;
+    DummyTelemetry(2, telemetry);
+    Controller::SolveResult shifted = Drive(mpc, telemetry, road);
+    if (!shifted.fallback || mpc.fallbacks != 2) {
+        std::cout << "Failed tick after a plan" << (shifted.fallback ? "" : " not") << " a fallback"
+                  << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+struct Check {
+    const char* name;
+    bool (*run)(const Options& options);
+};
+
+static const Check checks[] = {
+    {"derivatives", CheckDerivatives},
+    {"allocations", CheckAllocations},
+    {"text_frames", CheckTextFrames},
+    {"binary_frames", CheckBinaryFrames},
+    {"fallback", CheckFallback},
+};
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<const Check*> run;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (options.Parse(arg)) {
+            continue;
+        }
+        const Check* check = NULL;
+        for (const Check& c : checks) {
+            if (arg == c.name) {
+                check = &c;
+            }
+        }
+        if (check == NULL) {
+            std::cerr << "Unknown check or option " << arg << std::endl;
+            return -1;
+        }
+        run.push_back(check);
+    }
+    if (run.empty()) {
+        std::cerr << "Usage: mpc_tests [controller options] <check>..." << std::endl;
+        return -1;
+    }
+
+    bool ok = true;
+    for (const Check* check : run) {
+        bool passed = check->run(options);
+        std::cout << check->name << (passed ? " ok" : " failed") << std::endl;
+        ok = ok && passed;
+    }
+    return ok ? 0 : 1;
+}